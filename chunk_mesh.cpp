@@ -5,58 +5,48 @@ extern "C" {
 }
 
 #include "chunk_mesh.h"
-#include "nasl/nasl.h"
 
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 
+// Each face is a quad, its corners go around it so that indices 0 1 2 and 0 2 3 make two triangles facing out
 #define MINUS_X_FACE(V) \
 V(-1, -1, -1,   0, 0, -1, 0, 0) \
 V(-1,  1, -1,   0, 1, -1, 0, 0) \
 V(-1,  1,  1,   1, 1, -1, 0, 0) \
-V(-1, -1, -1,   0, 0, -1, 0, 0) \
-V(-1,  1,  1,   1, 1, -1, 0, 0) \
 V(-1, -1,  1,   1, 0, -1, 0, 0)
 
 #define PLUS_X_FACE(V) \
-V(1,   1, -1,   1, 1, 1, 0, 0) \
 V(1,  -1, -1,   1, 0, 1, 0, 0) \
+V(1,  -1,  1,   0, 0, 1, 0, 0) \
 V(1,   1,  1,   0, 1, 1, 0, 0) \
-V(1,   1,  1,   0, 1, 1, 0, 0) \
-V(1,  -1, -1,   1, 0, 1, 0, 0) \
-V(1,  -1,  1,   0, 0, 1, 0, 0)
+V(1,   1, -1,   1, 1, 1, 0, 0)
 
 #define MINUS_Z_FACE(V) \
-V(1,   1, -1,   0, 1, 0, 0, -1) \
 V(-1, -1, -1,   1, 0, 0, 0, -1) \
 V(1,  -1, -1,   0, 0, 0, 0, -1) \
-V(-1,  1, -1,   1, 1, 0, 0, -1) \
-V(-1, -1, -1,   1, 0, 0, 0, -1) \
-V(1,   1, -1,   0, 1, 0, 0, -1)
+V(1,   1, -1,   0, 1, 0, 0, -1) \
+V(-1,  1, -1,   1, 1, 0, 0, -1)
 
 #define PLUS_Z_FACE(V) \
-V(1,  -1,  1,   1, 0, 0, 0, 1) \
 V(-1, -1,  1,   0, 0, 0, 0, 1) \
+V(-1,  1,  1,   0, 1, 0, 0, 1) \
 V(1,   1,  1,   1, 1, 0, 0, 1) \
-V(1,   1,  1,   1, 1, 0, 0, 1) \
-V(-1, -1,  1,   0, 0, 0, 0, 1) \
-V(-1,  1,  1,   0, 1, 0, 0, 1)
+V(1,  -1,  1,   1, 0, 0, 0, 1)
 
 #define MINUS_Y_FACE(V) \
 V(-1, -1, -1,   0, 0, 0, -1, 0) \
+V(-1, -1,  1,   0, 1, 0, -1, 0) \
 V(1,  -1,  1,   1, 1, 0, -1, 0) \
-V(1,  -1, -1,   1, 0, 0, -1, 0) \
-V(1,  -1,  1,   1, 1, 0, -1, 0) \
-V(-1, -1, -1,   0, 0, 0, -1, 0) \
-V(-1, -1,  1,   0, 1, 0, -1, 0)
+V(1,  -1, -1,   1, 0, 0, -1, 0)
 
 #define PLUS_Y_FACE(V) \
-V(1,   1,  1,   1, 0, 0, 1, 0) \
 V(-1,  1, -1,   0, 1, 0, 1, 0) \
 V(1,   1, -1,   1, 1, 0, 1, 0) \
-V(-1,  1,  1,   0, 0, 0, 1, 0) \
-V(-1,  1, -1,   0, 1, 0, 1, 0) \
-V(1,   1,  1,   1, 0, 0, 1, 0)
+V(1,   1,  1,   1, 0, 0, 1, 0) \
+V(-1,  1,  1,   0, 0, 0, 1, 0)
 
 #define CUBE(V) \
 MINUS_X_FACE(V) \
@@ -67,176 +57,363 @@ MINUS_Y_FACE(V) \
 PLUS_Y_FACE(V)\
 
 //#define V(cx, cy, cz, t, s, nx, ny, nz) tmp[0] = (int) ((cx + 1) / 2) + (float) x; tmp[1] = (int) ((cy + 1) / 2) + (float) y; tmp[2] = (int) ((cz + 1) / 2) + (float) z; tmp[3] = t; tmp[4] = s; g.push_back(tmp[0]); g.push_back(tmp[1]); g.push_back(tmp[2]); g.push_back(tmp[3]); g.push_back(tmp[4]);
+static void add_vertex(std::vector<uint8_t>& g, BlockFace face, BlockData block, unsigned x, unsigned y, unsigned z) {
+    ChunkMesh::Vertex v = ChunkMesh::pack_vertex(x, y, z, face, block);
+    uint8_t tmp[sizeof(v)];
+    memcpy(tmp, &v, sizeof(v));
+    g.insert(g.end(), tmp, tmp + sizeof(v));
+}
+
 #define V(cx, cy, cz, t, s, nx, ny, nz) \
-v.vx = ((cx + 1) / 2) + x;             \
-v.vy = ((cy + 1) / 2) + y;             \
-v.vz = ((cz + 1) / 2) + z;             \
-v.tt = t * 255;             \
-v.ss = t * 255;             \
-v.nnx = nx * 127 + 128;            \
-v.nny = ny * 127 + 128;            \
-v.nnz = nz * 127 + 128;            \
-v.br = color.x * 255;            \
-v.bg = color.y * 255;            \
-v.bb = color.z * 255;            \
-add_vertex();
-
-static void paste_minus_x_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+add_vertex(g, face, block, ((cx + 1) / 2) * sx + x, ((cy + 1) / 2) * sy + y, ((cz + 1) / 2) * sz + z);
+
+static void paste_minus_x_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = WEST;
     MINUS_X_FACE(V)
 }
 
-static void paste_plus_x_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+static void paste_plus_x_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = EAST;
     PLUS_X_FACE(V)
 }
 
-static void paste_minus_y_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+static void paste_minus_y_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = BOTTOM;
     MINUS_Y_FACE(V)
 }
 
-static void paste_plus_y_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+static void paste_plus_y_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = TOP;
     PLUS_Y_FACE(V)
 }
 
-static void paste_minus_z_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+static void paste_minus_z_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = NORTH;
     MINUS_Z_FACE(V)
 }
 
-static void paste_plus_z_face(std::vector<uint8_t>& g, nasl::vec3 color, unsigned x, unsigned y, unsigned z) {
-    float tmp[5];
-    ChunkMesh::Vertex v;
-    auto add_vertex = [&](){
-        uint8_t tmp[sizeof(v)];
-        memcpy(tmp, &v, sizeof(v));
-        for (auto b : tmp)
-            g.push_back(b);
-    };
+static void paste_plus_z_face(std::vector<uint8_t>& g, BlockData block, unsigned x, unsigned y, unsigned z, unsigned sx = 1, unsigned sy = 1, unsigned sz = 1) {
+    const BlockFace face = SOUTH;
     PLUS_Z_FACE(V)
 }
 
 #undef V
 
-static BlockData access_safe(const ChunkData* chunk, ChunkNeighbors& neighbours, int x, int y, int z) {
-    unsigned int i, k;
-    if (x < 0) {
-        i = 0;
-    } else if (x < CUNK_CHUNK_SIZE) {
-        i = 1;
-    } else {
-        i = 2;
+/// sx, sy, sz is the size of the face along each axis, 1 along the face's normal
+typedef void (*PasteFace)(std::vector<uint8_t>&, BlockData, unsigned, unsigned, unsigned, unsigned, unsigned, unsigned);
+
+#define LAYER_SIZE (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE)
+#define APRON_SIZE (CUNK_CHUNK_SIZE + 2)
+
+/// A section with a one-block apron taken from the sections around it, diagonal ones included, so that anything looking at a block and the ones touching it
+/// (faces now, ambient occlusion or lighting later) reads plain array entries. blocks[y + 1][z + 1][x + 1] is the block at x, y, z, for x, y, z from -1 to 16.
+/// Missing chunks and sections past the top and bottom of the world are air.
+struct PaddedSection {
+    BlockData blocks[APRON_SIZE][APRON_SIZE][APRON_SIZE];
+
+    void read(ChunkNeighbors& neighbours, int section) {
+        const ChunkData* chunk = neighbours.neighbours[1][1];
+        BlockData tmp[CUNK_SECTION_BLOCKS_COUNT];
+
+        chunk_read_section_blocks(chunk, section, tmp);
+        for (int y = 0; y < CUNK_CHUNK_SIZE; y++)
+            for (int z = 0; z < CUNK_CHUNK_SIZE; z++)
+                memcpy(&blocks[y + 1][z + 1][1], &tmp[(y * CUNK_CHUNK_SIZE + z) * CUNK_CHUNK_SIZE], CUNK_CHUNK_SIZE * sizeof(BlockData));
+
+        // faces, read in bulk: z, x order
+        read_layer(chunk, section - 1, CUNK_CHUNK_SIZE - 1, tmp);
+        store_layer(tmp, 0);
+        read_layer(chunk, section + 1, 0, tmp);
+        store_layer(tmp, APRON_SIZE - 1);
+        // y, z order
+        read_x_slice(neighbours.neighbours[0][1], section, CUNK_CHUNK_SIZE - 1, tmp);
+        store_x_slice(tmp, 0);
+        read_x_slice(neighbours.neighbours[2][1], section, 0, tmp);
+        store_x_slice(tmp, APRON_SIZE - 1);
+        // y, x order
+        read_z_slice(neighbours.neighbours[1][0], section, CUNK_CHUNK_SIZE - 1, tmp);
+        store_z_slice(tmp, 0);
+        read_z_slice(neighbours.neighbours[1][2], section, 0, tmp);
+        store_z_slice(tmp, APRON_SIZE - 1);
+
+        // the 12 edges and 8 corners are a few hundred blocks, fetched one by one
+        for (int y = -1; y <= CUNK_CHUNK_SIZE; y++)
+            for (int z = -1; z <= CUNK_CHUNK_SIZE; z += CUNK_CHUNK_SIZE + 1)
+                for (int x = -1; x <= CUNK_CHUNK_SIZE; x += CUNK_CHUNK_SIZE + 1)
+                    blocks[y + 1][z + 1][x + 1] = apron_block(neighbours, section, x, y, z);
+        for (int y = -1; y <= CUNK_CHUNK_SIZE; y += CUNK_CHUNK_SIZE + 1)
+            for (int i = 0; i < CUNK_CHUNK_SIZE; i++) {
+                for (int z = -1; z <= CUNK_CHUNK_SIZE; z += CUNK_CHUNK_SIZE + 1)
+                    blocks[y + 1][z + 1][i + 1] = apron_block(neighbours, section, i, y, z);
+                for (int x = -1; x <= CUNK_CHUNK_SIZE; x += CUNK_CHUNK_SIZE + 1)
+                    blocks[y + 1][i + 1][x + 1] = apron_block(neighbours, section, x, y, i);
+            }
+    }
+
+    BlockData block(int x, int y, int z) const {
+        return blocks[y + 1][z + 1][x + 1];
+    }
+
+private:
+    void store_layer(const BlockData* src, int py) {
+        for (int z = 0; z < CUNK_CHUNK_SIZE; z++)
+            memcpy(&blocks[py][z + 1][1], &src[z * CUNK_CHUNK_SIZE], CUNK_CHUNK_SIZE * sizeof(BlockData));
+    }
+
+    void store_x_slice(const BlockData* src, int px) {
+        for (int y = 0; y < CUNK_CHUNK_SIZE; y++)
+            for (int z = 0; z < CUNK_CHUNK_SIZE; z++)
+                blocks[y + 1][z + 1][px] = src[y * CUNK_CHUNK_SIZE + z];
+    }
+
+    void store_z_slice(const BlockData* src, int pz) {
+        for (int y = 0; y < CUNK_CHUNK_SIZE; y++)
+            memcpy(&blocks[y + 1][pz][1], &src[y * CUNK_CHUNK_SIZE], CUNK_CHUNK_SIZE * sizeof(BlockData));
+    }
+
+    /// x, y, z relative to the section, up to one block outside of it on any axis
+    static BlockData apron_block(ChunkNeighbors& neighbours, int section, int x, int y, int z) {
+        int cx = x < 0 ? 0 : x < CUNK_CHUNK_SIZE ? 1 : 2;
+        int cz = z < 0 ? 0 : z < CUNK_CHUNK_SIZE ? 1 : 2;
+        const ChunkData* chunk = neighbours.neighbours[cx][cz];
+        int world_y = section * CUNK_CHUNK_SIZE + y;
+        if (!chunk || world_y < 0 || world_y >= CUNK_CHUNK_MAX_HEIGHT)
+            return BlockAir;
+        return chunk_get_block_data(chunk, (x + CUNK_CHUNK_SIZE) % CUNK_CHUNK_SIZE, world_y, (z + CUNK_CHUNK_SIZE) % CUNK_CHUNK_SIZE);
     }
 
-    if (y < 0 || y > CUNK_CHUNK_MAX_HEIGHT)
-        return BlockAir;
+    static void fill_air(BlockData* dst) {
+        for (int i = 0; i < LAYER_SIZE; i++)
+            dst[i] = BlockAir;
+    }
 
-    if (z < 0) {
-        k = 0;
-    } else if (z < CUNK_CHUNK_SIZE) {
-        k = 1;
-    } else {
-        k = 2;
+    static void read_layer(const ChunkData* chunk, int section, unsigned y, BlockData* dst) {
+        if (section < 0 || section >= CUNK_CHUNK_SECTIONS_COUNT)
+            return fill_air(dst);
+        chunk_read_section_layer(chunk, section, y, dst);
     }
-    //assert(!neighbours || neighbours[1][1][1] == chunk);
-    if (i == 1 && k == 1) {
-        return chunk_get_block_data(chunk, x, y, z);
-    } else {
-        if (neighbours.neighbours[i][k])
-            return chunk_get_block_data(neighbours.neighbours[i][k], x & 15, y, z & 15);
+
+    static void read_x_slice(const ChunkData* chunk, int section, unsigned x, BlockData* dst) {
+        if (!chunk)
+            return fill_air(dst);
+        chunk_read_section_x_slice(chunk, section, x, dst);
     }
 
-    return BlockAir;
+    static void read_z_slice(const ChunkData* chunk, int section, unsigned z, BlockData* dst) {
+        if (!chunk)
+            return fill_air(dst);
+        chunk_read_section_z_slice(chunk, section, z, dst);
+    }
+};
+
+/// Which blocks of a PaddedSection aren't air: bit x + 1 of rows[y + 1][z + 1] is the block at x, y, z
+struct SectionOccupancy {
+    uint32_t rows[APRON_SIZE][APRON_SIZE];
+
+    void build(const PaddedSection& n) {
+        for (int y = 0; y < APRON_SIZE; y++)
+            for (int z = 0; z < APRON_SIZE; z++) {
+                const BlockData* line = n.blocks[y][z];
+                uint32_t row = 0;
+                for (int x = 0; x < APRON_SIZE; x++)
+                    row |= (uint32_t) (line[x] != BlockAir) << x;
+                rows[y][z] = row;
+            }
+    }
+};
+
+/// Bit x of faces[face][y][z] is set when the block at x, y, z has a visible face on that side (faces are in BlockFace order).
+/// Whole rows at a time: a face shows where the block is there and its neighbour towards the face isn't.
+static void find_visible_faces(const SectionOccupancy& o, uint16_t faces[6][CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE]) {
+    for (int y = 0; y < CUNK_CHUNK_SIZE; y++)
+        for (int z = 0; z < CUNK_CHUNK_SIZE; z++) {
+            uint32_t row = o.rows[y + 1][z + 1];
+            faces[WEST][y][z] = (uint16_t) ((row & ~(row << 1)) >> 1);
+            faces[EAST][y][z] = (uint16_t) ((row & ~(row >> 1)) >> 1);
+            faces[NORTH][y][z] = (uint16_t) ((row & ~o.rows[y + 1][z]) >> 1);
+            faces[SOUTH][y][z] = (uint16_t) ((row & ~o.rows[y + 1][z + 2]) >> 1);
+            faces[BOTTOM][y][z] = (uint16_t) ((row & ~o.rows[y][z + 1]) >> 1);
+            faces[TOP][y][z] = (uint16_t) ((row & ~o.rows[y + 2][z + 1]) >> 1);
+        }
+}
+
+static bool is_uniform_solid(const ChunkData* chunk, int section) {
+    if (!chunk || section < 0 || section >= CUNK_CHUNK_SECTIONS_COUNT)
+        return false;
+    ChunkSectionView view = chunk_get_section_view(chunk, section);
+    return view.kind == ChunkSectionUniform && view.palette[0] != BlockAir;
 }
 
-void chunk_mesh(const ChunkData* chunk, ChunkNeighbors& neighbours, std::vector<uint8_t>& g, size_t* num_verts) {
+/// Air sections, and solid ones buried in solid sections on all six sides, have nothing to show
+static bool section_has_no_faces(const ChunkData* chunk, ChunkNeighbors& neighbours, int section) {
+    ChunkSectionView view = chunk_get_section_view(chunk, section);
+    if (view.kind == ChunkSectionNull || (view.kind == ChunkSectionUniform && view.palette[0] == BlockAir))
+        return true;
+    return view.kind == ChunkSectionUniform && is_uniform_solid(chunk, section - 1) && is_uniform_solid(chunk, section + 1)
+        && is_uniform_solid(neighbours.neighbours[0][1], section) && is_uniform_solid(neighbours.neighbours[2][1], section)
+        && is_uniform_solid(neighbours.neighbours[1][0], section) && is_uniform_solid(neighbours.neighbours[1][2], section);
+}
+
+/// Layers of the section that hold non-air blocks in some column, everything outside of them is air
+static void section_y_range(const ChunkData* chunk, int section, int* bottom, int* top) {
+    int section_bottom = section * CUNK_CHUNK_SIZE;
+    *bottom = CUNK_CHUNK_SIZE;
+    *top = 0;
+    for (int column = 0; column < CUNK_CHUNK_COLUMNS_COUNT; column++) {
+        if (chunk->column_max[column] <= chunk->column_min[column])
+            continue;
+        *bottom = std::min(*bottom, std::max(chunk->column_min[column] - section_bottom, 0));
+        *top = std::max(*top, std::min(chunk->column_max[column] - section_bottom, CUNK_CHUNK_SIZE));
+    }
+}
+
+/// In BlockFace order
+static const PasteFace paste_faces[6] = {
+    paste_minus_x_face, paste_plus_x_face, paste_minus_z_face, paste_plus_z_face, paste_minus_y_face, paste_plus_y_face,
+};
+
+void chunk_mesh(const ChunkData* chunk, ChunkNeighbors& neighbours, int section, std::vector<uint8_t>& g, size_t* num_verts) {
     *num_verts = 0;
-    for (int section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++) {
-        for (int x = 0; x < CUNK_CHUNK_SIZE; x++)
-            for (int y = 0; y < CUNK_CHUNK_SIZE; y++)
-                for (int z = 0; z < CUNK_CHUNK_SIZE; z++) {
-                    int world_y = y + section * CUNK_CHUNK_SIZE;
-                    BlockData block_data = access_safe(chunk, neighbours, x, world_y, z);
-                    if (block_data != BlockAir) {
-                        nasl::vec3 color;
-                        color.x = block_colors[block_data].r;
-                        color.y = block_colors[block_data].g;
-                        color.z = block_colors[block_data].b;
-                        if (access_safe(chunk, neighbours, x, world_y + 1, z) == BlockAir) {
-                            paste_plus_y_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
-                        if (access_safe(chunk, neighbours, x, world_y - 1, z) == BlockAir) {
-                            paste_minus_y_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
-
-                        if (access_safe(chunk, neighbours, x + 1, world_y, z) == BlockAir) {
-                            paste_plus_x_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
-                        if (access_safe(chunk, neighbours, x - 1, world_y, z) == BlockAir) {
-                            paste_minus_x_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
-
-                        if (access_safe(chunk, neighbours, x, world_y, z + 1) == BlockAir) {
-                            paste_plus_z_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
-                        if (access_safe(chunk, neighbours, x, world_y, z - 1) == BlockAir) {
-                            paste_minus_z_face(g, color, x, world_y, z);
-                            *num_verts += 6;
-                        }
+    if (section_has_no_faces(chunk, neighbours, section))
+        return;
+    PaddedSection n;
+    SectionOccupancy occupancy;
+    uint16_t faces[6][CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE];
+    int bottom, top;
+    section_y_range(chunk, section, &bottom, &top);
+    n.read(neighbours, section);
+    occupancy.build(n);
+    find_visible_faces(occupancy, faces);
+    for (int face = 0; face < 6; face++)
+        for (int y = bottom; y < top; y++)
+            for (int z = 0; z < CUNK_CHUNK_SIZE; z++) {
+                for (unsigned bits = faces[face][y][z]; bits; bits &= bits - 1) {
+                    int x = __builtin_ctz(bits);
+                    paste_faces[face](g, n.block(x, y, z), x, y + section * CUNK_CHUNK_SIZE, z, 1, 1, 1);
+                    *num_verts += 4;
+                }
+            }
+}
+
+/// Faces looking along one axis: normal is the axis they look along, the faces of a layer are merged along u and v
+struct GreedyDirection {
+    BlockFace face;
+    int normal, u, v;
+};
+
+static const GreedyDirection greedy_directions[] = {
+    { WEST, 0, 2, 1 },
+    { EAST, 0, 2, 1 },
+    { BOTTOM, 1, 0, 2 },
+    { TOP, 1, 0, 2 },
+    { NORTH, 2, 0, 1 },
+    { SOUTH, 2, 0, 1 },
+};
+
+/// Same faces as chunk_mesh, but adjacent coplanar faces of the same block are merged into larger quads, one section layer at a time
+void chunk_mesh_greedy(const ChunkData* chunk, ChunkNeighbors& neighbours, int section, std::vector<uint8_t>& g, size_t* num_verts) {
+    *num_verts = 0;
+    if (section_has_no_faces(chunk, neighbours, section))
+        return;
+    PaddedSection n;
+    SectionOccupancy occupancy;
+    uint16_t faces[6][CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE];
+
+    n.read(neighbours, section);
+    occupancy.build(n);
+    find_visible_faces(occupancy, faces);
+    for (auto& direction : greedy_directions) {
+        for (int layer = 0; layer < CUNK_CHUNK_SIZE; layer++) {
+            // the block whose face is visible at each u, v of this layer, air where there's none
+            BlockData mask[CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE];
+            bool any = false;
+            for (int v = 0; v < CUNK_CHUNK_SIZE; v++)
+                for (int u = 0; u < CUNK_CHUNK_SIZE; u++) {
+                    int p[3];
+                    p[direction.normal] = layer;
+                    p[direction.u] = u;
+                    p[direction.v] = v;
+                    bool visible = faces[direction.face][p[1]][p[2]] >> p[0] & 1;
+                    mask[v][u] = visible ? n.block(p[0], p[1], p[2]) : (BlockData) BlockAir;
+                    any |= visible;
+                }
+            if (!any)
+                continue;
+
+            for (int v = 0; v < CUNK_CHUNK_SIZE; v++)
+                for (int u = 0; u < CUNK_CHUNK_SIZE;) {
+                    BlockData block = mask[v][u];
+                    if (block == BlockAir) {
+                        u++;
+                        continue;
+                    }
+                    int width = 1;
+                    while (u + width < CUNK_CHUNK_SIZE && mask[v][u + width] == block)
+                        width++;
+                    int height = 1;
+                    for (; v + height < CUNK_CHUNK_SIZE; height++) {
+                        int i = 0;
+                        while (i < width && mask[v + height][u + i] == block)
+                            i++;
+                        if (i < width)
+                            break;
                     }
+                    for (int dv = 0; dv < height; dv++)
+                        for (int du = 0; du < width; du++)
+                            mask[v + dv][u + du] = BlockAir;
+
+                    int p[3], size[3];
+                    p[direction.normal] = layer;
+                    p[direction.u] = u;
+                    p[direction.v] = v;
+                    size[direction.normal] = 1;
+                    size[direction.u] = width;
+                    size[direction.v] = height;
+                    paste_faces[direction.face](g, block, p[0], p[1] + section * CUNK_CHUNK_SIZE, p[2], size[0], size[1], size[2]);
+                    *num_verts += 4;
+                    u += width;
                 }
+        }
     }
 }
 
-ChunkMesh::ChunkMesh(imr::Device& d, ChunkNeighbors& n) {
-    std::vector<uint8_t> g;
-    chunk_mesh(n.neighbours[1][1], n, g, &num_verts);
+ChunkMesh::Geometry ChunkMesh::mesh_section(ChunkNeighbors& n, int section, bool greedy) {
+    Geometry geometry;
+    if (greedy)
+        chunk_mesh_greedy(n.neighbours[1][1], n, section, geometry.vertices, &geometry.num_verts);
+    else
+        chunk_mesh(n.neighbours[1][1], n, section, geometry.vertices, &geometry.num_verts);
+    return geometry;
+}
 
-    //fprintf(stderr, "%zu vertices, totalling %zu KiB of data\n", num_verts, num_verts * sizeof(float) * 5 / 1024);
-    //fflush(stderr);
+ChunkMesh::ChunkMesh(imr::Device& d, const Geometry& geometry) {
+    num_verts = geometry.num_verts;
 
-    size_t buffer_size = g.size() * sizeof(uint8_t);
-    void* buffer = g.data();
+    size_t buffer_size = geometry.vertices.size() * sizeof(uint8_t);
+    void* buffer = (void*) geometry.vertices.data();
 
     if (buffer_size > 0) {
         buf = std::make_unique<imr::Buffer>(d, buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
         buf->uploadDataSync(0, buffer_size, buffer);
     }
-}
\ No newline at end of file
+}
+
+std::unique_ptr<imr::Buffer> ChunkMesh::create_quad_index_buffer(imr::Device& d) {
+    std::vector<uint16_t> indices;
+    indices.reserve(max_quads_per_draw * 6);
+    for (size_t quad = 0; quad < max_quads_per_draw; quad++) {
+        uint16_t first = quad * 4;
+        for (uint16_t corner : { 0, 1, 2, 0, 2, 3 })
+            indices.push_back(first + corner);
+    }
+    size_t size = indices.size() * sizeof(uint16_t);
+    auto buffer = std::make_unique<imr::Buffer>(d, size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    buffer->uploadDataSync(0, size, indices.data());
+    return buffer;
+}
+
+std::unique_ptr<imr::Buffer> ChunkMesh::create_block_colors_buffer(imr::Device& d) {
+    auto buffer = std::make_unique<imr::Buffer>(d, sizeof(block_colors), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    buffer->uploadDataSync(0, sizeof(block_colors), (void*) block_colors);
+    return buffer;
+}
@@ -3,28 +3,55 @@
 
 #include "imr/imr.h"
 
+#include <cassert>
 #include <cstddef>
+#include <vector>
 
 struct ChunkNeighbors {
     const ChunkData* neighbours[3][3];
 };
 
+/// The faces of one section of a chunk, so that changes only rebuild the sections they touch
 struct ChunkMesh {
     std::unique_ptr<imr::Buffer> buf;
+    /// 4 per quad
     size_t num_verts;
 
-    ChunkMesh(imr::Device&, ChunkNeighbors& n);
+    /// Quads are drawn with the indices of create_quad_index_buffer, which being 16 bit only reach this many quads.
+    /// A section can't need more: even a checkerboard of blocks only has 6 faces for every other block.
+    static constexpr size_t max_quads_per_draw = 65536 / 4;
+    static_assert(CUNK_SECTION_BLOCKS_COUNT / 2 * 6 <= max_quads_per_draw);
+    /// Two triangles for each of max_quads_per_draw quads, made of 4 consecutive vertices each
+    static std::unique_ptr<imr::Buffer> create_quad_index_buffer(imr::Device&);
+
+    /// What a mesh is made of before it's uploaded
+    struct Geometry {
+        std::vector<uint8_t> vertices;
+        size_t num_verts = 0;
+    };
+
+    /// Only reads the chunks, so this can run on any thread as long as they don't change meanwhile.
+    /// greedy merges adjacent faces of the same block into larger quads.
+    static Geometry mesh_section(ChunkNeighbors& n, int section, bool greedy);
+    /// Uploads the geometry, from the thread that owns the device
+    ChunkMesh(imr::Device&, const Geometry&);
 
+    /// Corner of a face: x (5 bits, 0 to 16), y (9 bits, from the bottom of the chunk rather than the section), z (5 bits) and the BlockFace (3 bits) from the bottom up, then the block.
+    /// basic.vert rebuilds the normal from the face and looks the colour up with the block.
     struct Vertex {
-        int16_t vx, vy, vz;
-        uint8_t tt;
-        uint8_t ss;
-        uint8_t nnx, nny, nnz;
-        uint8_t pad;
-        uint8_t br, bg, bb, pad2;
+        uint32_t position_face;
+        uint32_t block;
     };
 
-    static_assert(sizeof(Vertex) == sizeof(uint8_t) * 16);
+    static_assert(sizeof(Vertex) == sizeof(uint8_t) * 8);
+
+    static Vertex pack_vertex(unsigned x, unsigned y, unsigned z, BlockFace face, BlockData block) {
+        assert(x <= CUNK_CHUNK_SIZE && y <= CUNK_CHUNK_MAX_HEIGHT && z <= CUNK_CHUNK_SIZE);
+        return { x | y << 5 | z << 14 | (uint32_t) face << 19, block };
+    }
+
+    /// block_colors, for basic.vert to read through its device address
+    static std::unique_ptr<imr::Buffer> create_block_colors_buffer(imr::Device&);
 };
 
 #endif
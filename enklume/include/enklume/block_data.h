@@ -9,6 +9,8 @@
 #define CUNK_CHUNK_SIZE 16
 #define CUNK_CHUNK_MAX_HEIGHT 384
 #define CUNK_CHUNK_SECTIONS_COUNT CUNK_CHUNK_MAX_HEIGHT / CUNK_CHUNK_SIZE
+/// Section Y of the bottom of ChunkData: its y = 0 is y = -64 in the world, where 1.18 worlds start. Older worlds only fill it from y = 64 (world y = 0) up.
+#define CUNK_CHUNK_MIN_SECTION (-4)
 
 enum BlockFace {
     WEST,
@@ -51,26 +53,111 @@ BLOCK_TYPES(B)
 #undef B
 };
 
-static struct { float r, g, b; } block_colors[] = {
+static const struct { float r, g, b; } block_colors[] = {
 #define B(name, r, g, b) { r, g, b},
     BLOCK_TYPES(B)
 #undef B
 };
 
-static BlockData air_data = 0;
+static const BlockData air_data = 0;
 
+#define CUNK_SECTION_BLOCKS_COUNT (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE)
+
+/// Blocks of a section are stored as indices into a palette of the ones it uses, with as few bits as that palette needs.
+/// Header, palette and words come from a single allocation.
 typedef struct {
-    BlockData block_data[CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE][CUNK_CHUNK_SIZE];
+    /// 0 if every block is palette[0], 1, 2, 4 or 8 bits of palette index per block, or 32 when there are too many different blocks and words holds the BlockData themselves
+    uint8_t bits;
+    uint16_t palette_size;
+    BlockData* palette;
+    /// one entry per block in y, z, x order, packed from the lowest bit up (never across words)
+    uint64_t* words;
 } ChunkSection;
 
+#define CUNK_CHUNK_COLUMNS_COUNT (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE)
+
+/// Missing sections are air
 typedef struct {
     ChunkSection* sections[CUNK_CHUNK_SECTIONS_COUNT];
+    /// Per column (z * CUNK_CHUNK_SIZE + x), every non-air block is in [column_min, column_max), which is empty for all air columns.
+    /// Kept up to date by all the setters below, but only ever widened: blocks replaced by air don't shrink them.
+    uint16_t column_min[CUNK_CHUNK_COLUMNS_COUNT], column_max[CUNK_CHUNK_COLUMNS_COUNT];
+    /// Bit s is set when section s changed, or the blocks touching it from the sections above and below did: whatever is built from it (meshes) is stale.
+    /// Set by all the setters below, cleared by whoever rebuilds.
+    uint32_t dirty_sections;
+    /// Same, for the sections of the chunks next to this one, per side in BlockFace order (WEST to SOUTH): set by changes to the outermost blocks on that side.
+    uint32_t dirty_borders[4];
 } ChunkData;
 
 BlockData chunk_get_block_data(const ChunkData*, unsigned x, unsigned y, unsigned z);
+/// Grows the palette (and the bits per block along with it) as needed
 void chunk_set_block_data(ChunkData*, unsigned x, unsigned y, unsigned z, BlockData);
 
+/// Replaces a whole section at once, blocks are in y, z, x order.
+void chunk_set_section_blocks(ChunkData*, unsigned section, const BlockData* blocks);
+/// Same, from indices into a palette (which may have duplicates and unused entries).
+void chunk_set_section_paletted(ChunkData*, unsigned section, size_t palette_size, const BlockData* palette, const uint16_t* indices);
+/// Sets every block of a section to the same one, without storing any indices.
+void chunk_set_section_uniform(ChunkData*, unsigned section, BlockData);
+/// Whether all of the section is one block (missing sections are uniform air), and which.
+/// The other blocks of a uniform solid section all hide each other, so only its shell can have visible faces.
+bool chunk_section_uniform_block(const ChunkData*, unsigned section, BlockData* block);
+/// Expands a whole section into dst (CUNK_SECTION_BLOCKS_COUNT entries, y, z, x order).
+void chunk_read_section_blocks(const ChunkData*, unsigned section, BlockData* dst);
+
+typedef enum {
+    /// not stored, all air
+    ChunkSectionNull,
+    /// every block is palette[0]
+    ChunkSectionUniform,
+    /// words holds indices into palette
+    ChunkSectionPaletted,
+    /// words holds the BlockData themselves, one per 32 bits
+    ChunkSectionDirect,
+} ChunkSectionKind;
+
+/// How a section is stored, for consumers that want to work on the packed data directly.
+/// Null and uniform sections have a palette of one (air for null ones) and no words.
+typedef struct {
+    ChunkSectionKind kind;
+    /// bits per block in words, 0 when there are none
+    unsigned bits;
+    size_t palette_size;
+    const BlockData* palette;
+    /// same layout as ChunkSection::words
+    const uint64_t* words;
+} ChunkSectionView;
+
+ChunkSectionView chunk_get_section_view(const ChunkData*, unsigned section);
+
+/// Horizontal layer y of a section (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE entries, z, x order).
+void chunk_read_section_layer(const ChunkData*, unsigned section, unsigned y, BlockData* dst);
+/// Vertical slice of a section at the given x (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE entries, y, z order), for the borders facing -x/+x.
+void chunk_read_section_x_slice(const ChunkData*, unsigned section, unsigned x, BlockData* dst);
+/// Vertical slice of a section at the given z (CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE entries, y, x order), for the borders facing -z/+z.
+void chunk_read_section_z_slice(const ChunkData*, unsigned section, unsigned z, BlockData* dst);
+/// All of the column at x, z, from the bottom up (CUNK_CHUNK_MAX_HEIGHT entries).
+void chunk_read_column(const ChunkData*, unsigned x, unsigned z, BlockData* dst);
+
 void load_from_mcchunk(ChunkData* dst_chunk, McChunk* chunk);
+/// Streams the chunk straight into dst_chunk without building an NBT tree, returns false if the chunk isn't there.
+bool load_from_mcregion(ChunkData* dst_chunk, McRegion* region, unsigned int x, unsigned int z);
 void enkl_destroy_chunk_data(ChunkData*);
 
+/// Section storage is recycled through a pool (with a cache per thread) instead of going back to the system right away.
+typedef struct {
+    /// sections in use and the bytes they take
+    size_t live_sections, live_bytes;
+    /// free storage held for reuse
+    size_t cached_bytes;
+    /// the most live_bytes and cached_bytes have been at any point
+    size_t peak_live_bytes, peak_cached_bytes;
+    /// sections served from free storage, and the ones that needed a new allocation
+    size_t reused, allocated;
+} Enkl_SectionPoolStats;
+
+void enkl_get_section_pool_stats(Enkl_SectionPoolStats*);
+/// Hands the free storage shared between threads back to the system, what threads keep for themselves stays.
+void enkl_trim_section_pool(void);
+
 #endif
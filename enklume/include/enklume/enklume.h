@@ -25,13 +25,45 @@ typedef struct McWorld_ McWorld;
 
 McWorld* cunk_open_mcworld(const char* folder, Enkl_Allocator*);
 void cunk_close_mcworld(McWorld*);
+/// When enabled, chunks keep their decompressed bytes and their NBT trees point into them instead of copying strings and arrays out.
+/// Off by default, only affects chunks opened afterwards.
+void cunk_mcworld_set_chunk_views(McWorld*, bool enabled);
 
 McRegion* cunk_open_mcregion(McWorld* world, int x, int z);
 void enkl_close_region(McRegion*);
 
+/// Decoded location/timestamp header of a region file, indexed [z][x]
+typedef struct {
+    /// bit x of present[z] is set if chunk (x, z) is stored in the region
+    uint32_t present[32];
+    /// in 4 KiB sectors from the start of the file
+    uint32_t sector_offsets[32][32];
+    uint8_t sector_counts[32][32];
+    uint32_t timestamps[32][32];
+} McRegionIndex;
+
+/// Reads only the 8 KiB header of a region file, returns false if the region doesn't exist or is truncated.
+bool cunk_scan_mcregion_index(McWorld* world, int x, int z, McRegionIndex* out);
+const McRegionIndex* cunk_mcregion_get_index(const McRegion*);
+bool cunk_mcregion_index_has_chunk(const McRegionIndex*, unsigned int x, unsigned int z);
+
 McChunk* cunk_open_mcchunk(McRegion* world, unsigned int x, unsigned int z);
 void enkl_close_chunk(McChunk* chunk);
 
+typedef struct {
+    unsigned int x, z;
+} McChunkPosition;
+
+/// Opens several chunks of a region in one go, out_chunks[i] is NULL if positions[i] isn't present.
+/// Payload headers are read and their sectors hinted for readahead in file order, then the payloads are inflated and decoded on the pool (or serially if it's NULL).
+/// The world's allocator has to be thread-safe when a pool is given.
+void cunk_open_mcchunks(McRegion* region, size_t count, const McChunkPosition* positions, McChunk** out_chunks, Enkl_ThreadPool* pool);
+
+typedef struct NBT_Visitor_ NBT_Visitor;
+/// Streams a chunk's NBT through the visitor instead of building a tree. Returns false if the chunk isn't present or can't be decoded.
+/// The decompressed data only lives for the duration of the call. Can be called concurrently for different chunks.
+bool cunk_visit_mcchunk(McRegion* region, unsigned int x, unsigned int z, NBT_Visitor* visitor);
+
 typedef struct NBT_Object_ NBT_Object;
 const NBT_Object* cunk_mcchunk_get_root(const McChunk*);
 McDataVersion cunk_mcchunk_get_data_version(const McChunk*);
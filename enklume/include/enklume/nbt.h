@@ -10,9 +10,11 @@
 typedef union NBT_Body_ NBT_Body;
 typedef struct NBT_Object_ NBT_Object;
 
-typedef struct { int32_t count; int8_t* arr; } NBT_ByteArray;
-typedef struct { int32_t count; int32_t* arr; } NBT_IntArray;
-typedef struct { int32_t count; int64_t* arr; } NBT_LongArray;
+typedef struct { int32_t count; const int8_t* arr; } NBT_ByteArray;
+/// Int and long arrays are converted to native endianness when copied out of the buffer, views keep them big-endian and possibly unaligned.
+/// Use the accessors below to read them either way.
+typedef struct { int32_t count; bool native_endian; const void* arr; } NBT_IntArray;
+typedef struct { int32_t count; bool native_endian; const void* arr; } NBT_LongArray;
 
 typedef int8_t NBT_Byte;
 typedef int16_t NBT_Short;
@@ -21,7 +23,8 @@ typedef int64_t NBT_Long;
 typedef float NBT_Float;
 typedef double NBT_Double;
 
-typedef const char* NBT_String;
+/// Not necessarily zero-terminated, see NBT_DecodeMode
+typedef struct { uint16_t length; const char* chars; } NBT_String;
 
 #define NBT_TAG_TYPES(T) \
 T(Byte,      byte)      \
@@ -50,6 +53,9 @@ typedef struct {
     NBT_Body* bodies;
 } NBT_List;
 
+/// Compounds with more children than this carry a hash index of them, stored right after the objects array
+#define NBT_COMPOUND_INDEX_THRESHOLD 8
+
 typedef struct {
     int32_t count;
     NBT_Object** objects;
@@ -63,20 +69,68 @@ NBT_TAG_TYPES(T)
 
 struct NBT_Object_ {
     NBT_Tag tag;
-    const char* name;
+    /// of the name, see cunk_nbt_make_key
+    uint32_t name_hash;
+    NBT_String name;
     NBT_Body body;
 };
 
+typedef enum {
+    /// Strings and arrays are copied out, the buffer can be discarded after decoding. Strings are zero-terminated.
+    NBT_Decode_Copy,
+    /// Names, strings and arrays point into the buffer, which has to outlive the tree.
+    /// Such trees are best decoded into an arena, as enkl_free_nbt can't be used on them.
+    NBT_Decode_View,
+} NBT_DecodeMode;
+
 NBT_Object* cunk_decode_nbt(size_t buffer_size, const char* buffer, Enkl_Allocator*);
+NBT_Object* cunk_decode_nbt_with_mode(size_t buffer_size, const char* buffer, NBT_DecodeMode, Enkl_Allocator*);
 void enkl_free_nbt(NBT_Object*, Enkl_Allocator* allocator);
 
 void enkl_print_nbt(Enkl_Printer*, const NBT_Object*);
 
+/// Callbacks for walking an NBT stream without building a tree, any of them may be NULL.
+typedef struct NBT_Visitor_ {
+    /// A value is about to be visited: either a named tag (index is -1) or element index of a list (the name is empty).
+    /// Returning false skips it without looking inside.
+    bool (*enter)(struct NBT_Visitor_*, NBT_Tag tag, NBT_String name, int32_t index);
+    /// Values that aren't lists or compounds, strings and arrays are views into the buffer.
+    void (*leaf)(struct NBT_Visitor_*, NBT_Tag tag, const NBT_Body* body);
+    /// Called for entered lists, before their elements.
+    void (*list)(struct NBT_Visitor_*, NBT_Tag element_tag, int32_t count);
+    /// Called once an entered list or compound has been fully visited.
+    void (*leave)(struct NBT_Visitor_*, NBT_Tag tag);
+} NBT_Visitor;
+
+/// Walks the NBT stream in buffer, allocates nothing. Returns false if there's nothing to visit.
+bool cunk_visit_nbt(size_t buffer_size, const char* buffer, NBT_Visitor*);
+
 const NBT_Object* cunk_nbt_compound_direct_access(const NBT_Compound* c, const char* name);
 const NBT_Object* cunk_nbt_compound_access(const NBT_Object*, const char*);
 
+/// A child name with its hash computed up front, for lookups done over and over
+typedef struct {
+    const char* name;
+    uint16_t length;
+    uint32_t hash;
+} NBT_Key;
+
+NBT_Key cunk_nbt_make_key(const char* name);
+/// The same hash keys and object names use
+uint32_t cunk_nbt_hash_string(NBT_String);
+const NBT_Object* cunk_nbt_compound_find(const NBT_Compound*, const NBT_Key*);
+/// Resolves several keys in a single pass over the children, found[i] is NULL if keys[i] isn't there
+void cunk_nbt_compound_find_many(const NBT_Compound*, size_t count, const NBT_Key* keys, const NBT_Object** found);
+
 #define X(N, s) const NBT_##N* cunk_nbt_extract_##s(const NBT_Object*);
 NBT_TAG_TYPES(X)
 #undef X
 
+bool cunk_nbt_string_equals(NBT_String, const char*);
+int32_t cunk_nbt_int_array_get(const NBT_IntArray*, int32_t i);
+int64_t cunk_nbt_long_array_get(const NBT_LongArray*, int32_t i);
+/// Copies the whole array into dst (count elements) in native endianness, in bulk.
+void cunk_nbt_int_array_to_native(const NBT_IntArray*, int32_t* dst);
+void cunk_nbt_long_array_to_native(const NBT_LongArray*, int64_t* dst);
+
 #endif
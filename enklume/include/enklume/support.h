@@ -13,6 +13,21 @@ typedef struct Enkl_Allocator_ {
 /// Default allocator
 Enkl_Allocator enkl_get_malloc_free_allocator(void);
 
+/// Bump allocator carving allocations out of big blocks taken from a backing allocator.
+/// Freeing individual allocations does nothing, everything is released at once by resetting or destroying the arena.
+typedef struct Enkl_Arena_ Enkl_Arena;
+
+Enkl_Arena* enkl_create_arena(Enkl_Allocator* backing, size_t block_size);
+void enkl_destroy_arena(Enkl_Arena*);
+/// Releases all allocations, the memory is kept around for reuse
+void enkl_reset_arena(Enkl_Arena*);
+Enkl_Allocator* enkl_get_arena_allocator(Enkl_Arena*);
+
+typedef struct Enkl_ThreadPool_ {
+    /// Runs task(uptr, i) for every i in [0, count) and returns once they are all done. Tasks may run concurrently.
+    void (*parallel_for)(struct Enkl_ThreadPool_*, size_t count, void (*task)(void* uptr, size_t i), void* uptr);
+} Enkl_ThreadPool;
+
 typedef struct Enkl_Printer_ {
     void (*newline)(struct Enkl_Printer_*);
     void (*indent)(struct Enkl_Printer_*);
@@ -0,0 +1,135 @@
+#include "enklume/support.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct ArenaBlock_ {
+    struct ArenaBlock_* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+} ArenaBlock;
+
+struct Enkl_Arena_ {
+    /// has to come first, the allocator callbacks cast back to the arena
+    Enkl_Allocator base;
+    Enkl_Allocator* backing;
+    size_t block_size;
+    /// the block we're currently bumping through comes first
+    ArenaBlock* blocks;
+    /// the most recent allocation can be grown in place
+    char* last_allocation;
+};
+
+static ArenaBlock* new_block(Enkl_Arena* arena, size_t size) {
+    ArenaBlock* block = arena->backing->allocate_bytes(arena->backing, sizeof(ArenaBlock) + size, alignof(ArenaBlock));
+    assert(block);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static size_t align_offset(const ArenaBlock* block, size_t alignment) {
+    uintptr_t at = (uintptr_t) block->data + block->used;
+    uintptr_t aligned = (at + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    return aligned - (uintptr_t) block->data;
+}
+
+static void* arena_allocate(Enkl_Arena* arena, size_t size, size_t alignment) {
+    if (alignment == 0)
+        alignment = alignof(max_align_t);
+    assert((alignment & (alignment - 1)) == 0);
+
+    ArenaBlock* block = arena->blocks;
+    size_t offset = align_offset(block, alignment);
+    if (offset + size > block->size) {
+        size_t needed = size + alignment;
+        if (needed > arena->block_size / 4) {
+            // big allocations get a block of their own, so the current one can keep filling up
+            ArenaBlock* dedicated = new_block(arena, needed);
+            dedicated->next = block->next;
+            block->next = dedicated;
+            offset = align_offset(dedicated, alignment);
+            dedicated->used = offset + size;
+            return dedicated->data + offset;
+        }
+        block = new_block(arena, arena->block_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+        offset = align_offset(block, alignment);
+    }
+
+    block->used = offset + size;
+    arena->last_allocation = block->data + offset;
+    return arena->last_allocation;
+}
+
+static void* arena_grow(Enkl_Arena* arena, void* old, size_t alignment, size_t old_size, size_t new_size) {
+    ArenaBlock* block = arena->blocks;
+    if (old && old == arena->last_allocation && (size_t) ((char*) old - block->data) + new_size <= block->size) {
+        block->used = (size_t) ((char*) old - block->data) + new_size;
+        return old;
+    }
+    void* grown = arena_allocate(arena, new_size, alignment);
+    if (old)
+        memcpy(grown, old, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+static void arena_free(Enkl_Arena* arena, void* ptr) {
+    // everything goes away at once in enkl_reset_arena
+    (void) arena;
+    (void) ptr;
+}
+
+Enkl_Arena* enkl_create_arena(Enkl_Allocator* backing, size_t block_size) {
+    Enkl_Arena* arena = backing->allocate_bytes(backing, sizeof(Enkl_Arena), alignof(Enkl_Arena));
+    *arena = (Enkl_Arena) {
+        .base = {
+            .allocate_bytes = (void* (*)(Enkl_Allocator*, size_t, size_t)) arena_allocate,
+            .grow_allocation = (void* (*)(Enkl_Allocator*, void*, size_t, size_t, size_t)) arena_grow,
+            .free_bytes = (void (*)(Enkl_Allocator*, void*)) arena_free,
+        },
+        .backing = backing,
+        .block_size = block_size,
+    };
+    arena->blocks = new_block(arena, block_size);
+    return arena;
+}
+
+void enkl_reset_arena(Enkl_Arena* arena) {
+    size_t total = 0;
+    for (ArenaBlock* block = arena->blocks; block; block = block->next)
+        total += block->size;
+
+    if (arena->blocks->next) {
+        // we outgrew the first block, replace everything by a single block big enough for all of it next time around
+        ArenaBlock* block = arena->blocks;
+        while (block) {
+            ArenaBlock* next = block->next;
+            arena->backing->free_bytes(arena->backing, block);
+            block = next;
+        }
+        arena->blocks = new_block(arena, total);
+    }
+
+    arena->blocks->used = 0;
+    arena->last_allocation = NULL;
+}
+
+void enkl_destroy_arena(Enkl_Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while (block) {
+        ArenaBlock* next = block->next;
+        arena->backing->free_bytes(arena->backing, block);
+        block = next;
+    }
+    arena->backing->free_bytes(arena->backing, arena);
+}
+
+Enkl_Allocator* enkl_get_arena_allocator(Enkl_Arena* arena) {
+    return &arena->base;
+}
@@ -1,222 +1,993 @@
 #include "enklume/enklume.h"
 #include "enklume/nbt.h"
 #include "support_private.h"
+#include "block_registry.h"
+#include "section_pool.h"
 
 #include "enklume/block_data.h"
 
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <threads.h>
 
+/// 17w47a, the first version with palettes of block states
+#define MC_FLATTENING_DATA_VERSION 1451
+/// 20w17a, indices don't straddle longs from there on
+#define MC_PACKED_STATES_DATA_VERSION 2504
 #define MC_1_18_DATA_VERSION 2825
 
-static BlockData decode_pre_flattening_id(uint8_t id) {
-    if (id == 0)
-        return BlockAir;
-    if (id == 1)
-        return BlockStone;
-    if (id == 2)
-        return BlockGrass;
-    if (id == 3)
-        return BlockDirt;
-    if (id == 4)
-        return BlockCobbleStone;
-    if (id == 5)
-        return BlockPlanks;
-    if (id == 8 || id == 9)
-        return BlockWater;
-    if (id == 10 || id == 11)
-        return BlockLava;
-    if (id == 12)
-        return BlockSand;
-    if (id == 13)
-        return BlockGravel;
-    if (id == 17 || id == 162)
-        return BlockWood;
-    if (id == 18 || id == 161 )
-        return BlockLeaves;
-    if (id == 24)
-        return BlockSandStone;
-    if (id == 31)
-        return BlockTallGrass;
-    if (id == 37)
-        return BlockDandelion;
-    if (id == 48)
-        return BlockMossyCobbleStone;
-    if (id == 78 || id == 80)
-        return BlockSnow;
-    if (id == 159)
-        return BlockWhiteTerracotta;
-    if (id == 155)
-        return BlockQuartz;
-    return BlockUnknown;
-}
-
-static BlockData decode_flattened_id(const char* id) {
-    if (strcmp("minecraft:air", id) == 0)
-        return BlockAir;
-    if (strcmp("minecraft:stone", id) == 0)
-        return BlockStone;
-    if (strcmp("minecraft:grass", id) == 0)
-        return BlockGrass;
-    if (strcmp("minecraft:dirt", id) == 0)
-        return BlockDirt;
-    if (strcmp("minecraft:cobblestone", id) == 0)
-        return BlockCobbleStone;
-    if (strcmp("minecraft:planks", id) == 0)
-        return BlockPlanks;
-    if ((strcmp("minecraft:water", id) == 0) || (strcmp("minecraft:flowing_water", id) == 0))
-        return BlockWater;
-    if ((strcmp("minecraft:lava", id) == 0) || (strcmp("minecraft:flowing_lava", id) == 0))
-        return BlockLava;
-    if (strcmp("minecraft:sand", id) == 0)
-        return BlockSand;
-    if (strcmp("minecraft:gravel", id) == 0)
-        return BlockGravel;
-    if (strcmp("minecraft:log", id) == 0 || strcmp("minecraft:log2", id) == 0)
-        return BlockWood;
-    if ((strcmp("minecraft:leaves", id) == 0) || strcmp("minecraft:leaves2", id) == 0)
-        return BlockLeaves;
-    if (strcmp("minecraft:sandstone", id) == 0)
-        return BlockSandStone;
-    if (strcmp("minecraft:tallgrass", id) == 0)
-        return BlockTallGrass;
-    if ((strcmp("minecraft:snow_layer", id) == 0) || strcmp("minecraft:snow", id) == 0)
-        return BlockSnow;
-    if (strcmp("minecraft:white_terracotta", id) == 0)
-        return BlockWhiteTerracotta;
-    if (strcmp("minecraft:quartz_block", id) == 0)
-        return BlockQuartz;
-    if (strcmp("minecraft:yellow_flower", id) == 0)
-        return BlockDandelion;
-    if (strcmp("minecraft:mossy_cobblestone", id) == 0)
-        return BlockMossyCobbleStone;
-    return BlockUnknown;
-}
-
-static void decode_pre_flattening(ChunkData* dst_chunk, int section_y, const NBT_Object* blocks_data) {
-    if (!blocks_data)
-        return;
-    const NBT_ByteArray* arr = cunk_nbt_extract_byte_array(blocks_data);
-    for (int pos = 0; pos < 16 * 16 * 16; pos++) {
-        int x = (pos >> 4) & 15;
-        int y = (pos >> 8) & 15;
-        int z = (pos >> 0) & 15;
+/// The ways block data has been stored over the years, each gets its own section decoder
+typedef enum {
+    /// numeric ids in 'Blocks' with their metadata in 'Data'
+    Format_PreFlattening,
+    /// 'BlockStates' and 'Palette', with indices spanning two longs at times (1.13 - 1.15)
+    Format_Straddling,
+    /// same, but indices never cross a long (1.16 - 1.17)
+    Format_Packed,
+    /// 'data' and 'palette' in a 'block_states' compound, sections at the root of the chunk and going down to y = -64 (1.18+)
+    Format_Sections,
+    Formats_Count,
+} ChunkFormat;
 
-        int8_t block_state = arr->arr[pos];
-        assert(pos < arr->count);
+static ChunkFormat chunk_format(McDataVersion ver) {
+    if (ver > MC_1_18_DATA_VERSION)
+        return Format_Sections;
+    if (ver >= MC_PACKED_STATES_DATA_VERSION)
+        return Format_Packed;
+    if (ver >= MC_FLATTENING_DATA_VERSION)
+        return Format_Straddling;
+    return Format_PreFlattening;
+}
 
-        chunk_set_block_data(dst_chunk, z, y + section_y * 16, x, decode_pre_flattening_id(block_state));
+/// Where a section goes in ChunkData, or -1 for the ones outside of it (1.18 keeps lighting only sections below and above the world)
+static int section_index(int section_y) {
+    int section = section_y - CUNK_CHUNK_MIN_SECTION;
+    return section >= 0 && section < CUNK_CHUNK_SECTIONS_COUNT ? section : -1;
+}
+
+/// meta holds the 'Data' nibbles, two per byte, and may be NULL
+static void decode_pre_flattening(ChunkData* dst_chunk, unsigned section, const NBT_ByteArray* arr, const NBT_ByteArray* meta) {
+    const BlockData* legacy_blocks = enkl_get_legacy_block_table();
+    if (meta && meta->count < CUNK_SECTION_BLOCKS_COUNT / 2)
+        meta = NULL;
+    BlockData blocks[CUNK_SECTION_BLOCKS_COUNT];
+    for (int pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++) {
+        assert(pos < arr->count);
+        uint8_t block_id = (uint8_t) arr->arr[pos];
+        uint8_t block_meta = meta ? ((uint8_t) meta->arr[pos >> 1] >> ((pos & 1) * 4)) & 15 : 0;
+        blocks[pos] = legacy_blocks[block_id << 4 | block_meta];
     }
+    chunk_set_section_blocks(dst_chunk, section, blocks);
 }
 
-static void decode_post_flattening(ChunkData* dst_chunk, int section_y, const NBT_Object* block_states, const NBT_Object* palette, bool can_straddle_boundary) {
-    if (!(block_states && palette))
-        return;
-    // cunk_print_nbt(p, palette);
-    assert(block_states->tag == NBT_Tag_LongArray && palette->tag == NBT_Tag_List);
-    const NBT_LongArray* block_state_arr = cunk_nbt_extract_long_array(block_states);
-    int palette_size = palette->body.p_list.count;
+/// Enough room for a full section at 64 bits per block
+#define MAX_SECTION_LONGS (16 * 16 * 16)
 
-    BlockData decoded[palette_size];
-    for (size_t j = 0; j < palette_size; j++) {
-        const NBT_Compound* color = &palette->body.p_list.bodies[j].p_compound;
-        const char* name = *cunk_nbt_extract_string(cunk_nbt_compound_direct_access(color, "Name"));
-        assert(name);
-        decoded[j] = decode_flattened_id(name);
+/// block_state_arr may be missing for palettes of one. Always inlined with a constant can_straddle_boundary.
+static inline void decode_post_flattening(ChunkData* dst_chunk, unsigned section, const NBT_LongArray* block_state_arr, int palette_size, const BlockData* decoded, bool can_straddle_boundary) {
+    // a single entry palette doesn't need any indices, and 1.18+ doesn't store them at all
+    if (palette_size == 1) {
+        chunk_set_section_uniform(dst_chunk, section, decoded[0]);
+        return;
     }
+    if (!block_state_arr)
+        return;
 
     int bits = enkl_needed_bits(palette_size);
     if (bits < 4)
         bits = 4;
 
-    int aligned_bitpos = 0;
-    for (int pos = 0; pos < 16 * 16 * 16; pos++) {
-        int x = (pos >> 4) & 15;
-        int y = (pos >> 8) & 15;
-        int z = (pos >> 0) & 15;
-
-        uint64_t block_state = enkl_fetch_bits_long_arr(block_state_arr->arr, true, aligned_bitpos, bits);
-        aligned_bitpos += bits;
-        // "Since 1.16, the indices are not packed across multiple elements of the array, meaning that if there is no more space in a given 64-bit integer for the next index, it starts instead at the first (lowest) bit of the next 64-bit element."
-        // https://minecraft.fandom.com/wiki/Chunk_format#NBT_structure
-        if (!can_straddle_boundary) {
-            int starting_long = aligned_bitpos / 64;
-            int finishing_long = (aligned_bitpos + bits - 1) / 64;
-            if (starting_long != finishing_long)
-                aligned_bitpos = finishing_long * 64;
-        }
+    // swap the whole array at once rather than every long again for each index fetched from it
+    assert(block_state_arr->count <= MAX_SECTION_LONGS);
+    int64_t block_state_longs[block_state_arr->count > 0 ? block_state_arr->count : 1];
+    cunk_nbt_long_array_to_native(block_state_arr, block_state_longs);
+
+    // "Since 1.16, the indices are not packed across multiple elements of the array, meaning that if there is no more space in a given 64-bit integer for the next index, it starts instead at the first (lowest) bit of the next 64-bit element."
+    // https://minecraft.fandom.com/wiki/Chunk_format#NBT_structure
+    uint16_t indices[CUNK_SECTION_BLOCKS_COUNT];
+    if (!enkl_unpack_section_indices((const uint64_t*) block_state_longs, block_state_arr->count, bits, can_straddle_boundary, indices))
+        return;
+    chunk_set_section_paletted(dst_chunk, section, palette_size, decoded, indices);
+}
+
+/// A section's block data, wherever the format keeps it. Absent parts are NULL.
+typedef struct {
+    const NBT_ByteArray* blocks;
+    const NBT_ByteArray* meta;
+    const NBT_LongArray* states;
+    size_t palette_size;
+    const NBT_String* palette;
+} SectionBlocks;
+
+typedef void (*SectionDecoder)(ChunkData*, unsigned section, const SectionBlocks*);
+
+static void decode_pre_flattening_section(ChunkData* dst_chunk, unsigned section, const SectionBlocks* blocks) {
+    if (blocks->blocks)
+        decode_pre_flattening(dst_chunk, section, blocks->blocks, blocks->meta);
+}
+
+static inline void decode_paletted_section(ChunkData* dst_chunk, unsigned section, const SectionBlocks* blocks, bool can_straddle_boundary) {
+    if (blocks->palette_size == 0)
+        return;
+    BlockData decoded[blocks->palette_size];
+    enkl_decode_block_palette(blocks->palette_size, blocks->palette, decoded);
+    decode_post_flattening(dst_chunk, section, blocks->states, (int) blocks->palette_size, decoded, can_straddle_boundary);
+}
+
+static void decode_straddling_section(ChunkData* dst_chunk, unsigned section, const SectionBlocks* blocks) {
+    decode_paletted_section(dst_chunk, section, blocks, true);
+}
+
+static void decode_packed_section(ChunkData* dst_chunk, unsigned section, const SectionBlocks* blocks) {
+    decode_paletted_section(dst_chunk, section, blocks, false);
+}
+
+static const SectionDecoder section_decoders[Formats_Count] = {
+    [Format_PreFlattening] = decode_pre_flattening_section,
+    [Format_Straddling] = decode_straddling_section,
+    [Format_Packed] = decode_packed_section,
+    [Format_Sections] = decode_packed_section,
+};
 
-        assert(block_state < palette_size);
-        block_state %= palette_size;
-        chunk_set_block_data(dst_chunk, z, y + section_y * 16, x, decoded[block_state]);
+/// What the tree loader looks for in each section
+typedef enum {
+    Slot_Y, Slot_Container, Slot_Blocks, Slot_Meta, Slot_States, Slot_Palette,
+    Slots_Count,
+} SectionSlot;
+
+/// Where each format keeps its sections and their block data, NULL for what it doesn't have
+typedef struct {
+    const char* level;
+    const char* sections;
+    /// compound holding the states and palette, rather than the section itself
+    const char* container;
+    const char* slots[Slots_Count];
+} TreeLayout;
+
+static const TreeLayout tree_layouts[Formats_Count] = {
+    [Format_PreFlattening] = { "Level", "Sections", NULL, { [Slot_Y] = "Y", [Slot_Blocks] = "Blocks", [Slot_Meta] = "Data" } },
+    [Format_Straddling] = { "Level", "Sections", NULL, { [Slot_Y] = "Y", [Slot_States] = "BlockStates", [Slot_Palette] = "Palette" } },
+    [Format_Packed] = { "Level", "Sections", NULL, { [Slot_Y] = "Y", [Slot_States] = "BlockStates", [Slot_Palette] = "Palette" } },
+    [Format_Sections] = { NULL, "sections", "block_states", { [Slot_Y] = "Y", [Slot_States] = "data", [Slot_Palette] = "palette" } },
+};
+
+/// A layout's names hashed once, split by which compound they are looked up in
+typedef struct {
+    bool has_level;
+    NBT_Key level, sections;
+    size_t section_keys_count, container_keys_count;
+    NBT_Key section_keys[Slots_Count], container_keys[Slots_Count];
+    SectionSlot section_slots[Slots_Count], container_slots[Slots_Count];
+} TreeLayoutKeys;
+
+static TreeLayoutKeys tree_layout_keys[Formats_Count];
+static NBT_Key palette_name_key;
+static once_flag tree_keys_once = ONCE_FLAG_INIT;
+
+static void init_tree_keys(void) {
+    for (int f = 0; f < Formats_Count; f++) {
+        const TreeLayout* layout = &tree_layouts[f];
+        TreeLayoutKeys* keys = &tree_layout_keys[f];
+        keys->has_level = layout->level != NULL;
+        if (layout->level)
+            keys->level = cunk_nbt_make_key(layout->level);
+        keys->sections = cunk_nbt_make_key(layout->sections);
+        if (layout->container) {
+            keys->section_slots[keys->section_keys_count] = Slot_Container;
+            keys->section_keys[keys->section_keys_count++] = cunk_nbt_make_key(layout->container);
+        }
+        for (int slot = 0; slot < Slots_Count; slot++) {
+            if (!layout->slots[slot])
+                continue;
+            // everything but Y lives in the container when there is one
+            if (layout->container && slot != Slot_Y) {
+                keys->container_slots[keys->container_keys_count] = slot;
+                keys->container_keys[keys->container_keys_count++] = cunk_nbt_make_key(layout->slots[slot]);
+            } else {
+                keys->section_slots[keys->section_keys_count] = slot;
+                keys->section_keys[keys->section_keys_count++] = cunk_nbt_make_key(layout->slots[slot]);
+            }
+        }
     }
+    palette_name_key = cunk_nbt_make_key("Name");
+}
+
+static void find_slots(const NBT_Compound* c, size_t count, const NBT_Key* keys, const SectionSlot* slots, const NBT_Object** found) {
+    const NBT_Object* objects[Slots_Count];
+    cunk_nbt_compound_find_many(c, count, keys, objects);
+    for (size_t i = 0; i < count; i++)
+        found[slots[i]] = objects[i];
 }
 
 void load_from_mcchunk(ChunkData* dst_chunk, McChunk* chunk) {
-    McDataVersion ver = cunk_mcchunk_get_data_version(chunk);
-    bool post_1_18 = ver > MC_1_18_DATA_VERSION;
+    call_once(&tree_keys_once, init_tree_keys);
+    ChunkFormat format = chunk_format(cunk_mcchunk_get_data_version(chunk));
+    const TreeLayoutKeys* keys = &tree_layout_keys[format];
+    SectionDecoder decode_section = section_decoders[format];
 
     const NBT_Object *o = cunk_mcchunk_get_root(chunk);
     assert(o);
-
-    const NBT_Object *level = cunk_nbt_compound_access(o, "Level");
-    if (level)
-        o = level;
-    else
-        assert(post_1_18);
-    assert(o);
+    if (keys->has_level) {
+        o = cunk_nbt_compound_find(cunk_nbt_extract_compound(o), &keys->level);
+        assert(o);
+    }
     // Iterate over sections
-    o = cunk_nbt_compound_access(o, post_1_18 ? "sections" : "Sections");
+    o = cunk_nbt_compound_find(cunk_nbt_extract_compound(o), &keys->sections);
     assert(o);
     const NBT_List* sections = cunk_nbt_extract_list(o);
     assert(sections);
     assert(sections->tag == NBT_Tag_Compound);
     for (size_t i = 0; i < sections->count; i++) {
         const NBT_Compound* section = &sections->bodies[i].p_compound;
-        int8_t section_y = *cunk_nbt_extract_byte(cunk_nbt_compound_direct_access(section, "Y"));
-        if (section_y < 0)
+        const NBT_Object* found[Slots_Count] = { 0 };
+        find_slots(section, keys->section_keys_count, keys->section_keys, keys->section_slots, found);
+        if (found[Slot_Container])
+            find_slots(cunk_nbt_extract_compound(found[Slot_Container]), keys->container_keys_count, keys->container_keys, keys->container_slots, found);
+
+        int section_id = section_index(*cunk_nbt_extract_byte(found[Slot_Y]));
+        if (section_id < 0)
             continue;
 
-        const NBT_Object* blocks_data = cunk_nbt_compound_direct_access(section, "Blocks");
-        if (blocks_data) {
-            decode_pre_flattening(dst_chunk, section_y, blocks_data);
-        } else {
-            // Starting with 1.18, block data for a chunk section is stored in a 'block_states' compound
-            const NBT_Compound* container = section;
-            const NBT_Object* block_states_container = cunk_nbt_compound_direct_access(section, "block_states");
-            if (post_1_18 && block_states_container)
-                container = cunk_nbt_extract_compound(block_states_container);
-
-            const NBT_Object* block_states = cunk_nbt_compound_direct_access(container, post_1_18 ? "data" : "BlockStates");
-            const NBT_Object* palette = cunk_nbt_compound_direct_access(container, post_1_18 ? "palette" : "Palette");
-            decode_post_flattening(dst_chunk, section_y, block_states, palette, ver < 2504);
+        const NBT_List* palette = found[Slot_Palette] ? cunk_nbt_extract_list(found[Slot_Palette]) : NULL;
+        size_t palette_size = palette ? palette->count : 0;
+        NBT_String names[palette_size > 0 ? palette_size : 1];
+        for (size_t j = 0; j < palette_size; j++) {
+            const NBT_Compound* color = &palette->bodies[j].p_compound;
+            const NBT_String* name = cunk_nbt_extract_string(cunk_nbt_compound_find(color, &palette_name_key));
+            assert(name);
+            names[j] = *name;
         }
+
+        SectionBlocks blocks = {
+            .blocks = found[Slot_Blocks] ? cunk_nbt_extract_byte_array(found[Slot_Blocks]) : NULL,
+            .meta = found[Slot_Meta] ? cunk_nbt_extract_byte_array(found[Slot_Meta]) : NULL,
+            .states = found[Slot_States] ? cunk_nbt_extract_long_array(found[Slot_States]) : NULL,
+            .palette_size = palette_size,
+            .palette = names,
+        };
+        decode_section(dst_chunk, section_id, &blocks);
     }
 }
 
+/// Where the stream loader currently is, only the parts leading to block data are entered
+typedef enum {
+    Stream_Root, Stream_Level, Stream_Sections, Stream_Section, Stream_BlockStates, Stream_Palette, Stream_PaletteEntry,
+} StreamScope;
+
+/// Which leaf the loader is about to be handed
+typedef enum {
+    Stream_Ignore, Stream_DataVersion, Stream_Y, Stream_Blocks, Stream_LegacyData, Stream_LegacyStates, Stream_States, Stream_Name,
+} StreamField;
+
+#define STREAM_MAX_DEPTH 8
+
+typedef struct {
+    bool has_y, has_blocks, has_legacy_data, has_legacy_states, has_states;
+    int8_t y;
+    NBT_ByteArray blocks, legacy_data;
+    /// BlockStates/Palette directly in the section, or data/palette in the block_states compound (1.18+)
+    NBT_LongArray legacy_states, states;
+    size_t legacy_palette_start, legacy_palette_size;
+    size_t palette_start, palette_size;
+} StreamSection;
+
+typedef struct {
+    NBT_Visitor visitor;
+    StreamScope scopes[STREAM_MAX_DEPTH];
+    int depth;
+    StreamField field;
+    bool legacy_palette;
+
+    bool has_version;
+    McDataVersion version;
+    bool has_level, has_legacy_sections, has_sections;
+
+    /// the data version isn't necessarily known before the sections come by, so they're kept around (as views) and decoded when leaving the root compound:
+    /// the views point into the decompressed data, which is gone once cunk_visit_mcchunk returns
+    StreamSection* sections;
+    size_t sections_count, sections_capacity;
+    NBT_String* names;
+    size_t names_count, names_capacity;
+
+    ChunkData* dst_chunk;
+    bool decoded;
+} StreamLoader;
+
+static void* grow_array(void* arr, size_t* capacity, size_t count, size_t element_size) {
+    if (count < *capacity)
+        return arr;
+    *capacity = *capacity ? *capacity * 2 : 32;
+    arr = realloc(arr, *capacity * element_size);
+    assert(arr);
+    return arr;
+}
+
+static bool stream_enter(StreamLoader* loader, NBT_Tag tag, NBT_String name, int32_t index) {
+    (void) index;
+    StreamScope scope = Stream_Root;
+    loader->field = Stream_Ignore;
+    if (loader->depth == 0) {
+        // the root compound itself
+        scope = Stream_Root;
+    } else {
+        switch (loader->scopes[loader->depth - 1]) {
+            case Stream_Root:
+                if (tag == NBT_Tag_Int && cunk_nbt_string_equals(name, "DataVersion")) {
+                    loader->field = Stream_DataVersion;
+                    return true;
+                }
+                if (tag == NBT_Tag_Compound && cunk_nbt_string_equals(name, "Level")) {
+                    loader->has_level = true;
+                    scope = Stream_Level;
+                    break;
+                }
+                if (tag == NBT_Tag_List && cunk_nbt_string_equals(name, "sections")) {
+                    loader->has_sections = true;
+                    scope = Stream_Sections;
+                    break;
+                }
+                return false;
+            case Stream_Level:
+                if (tag == NBT_Tag_List && cunk_nbt_string_equals(name, "Sections")) {
+                    loader->has_legacy_sections = true;
+                    scope = Stream_Sections;
+                    break;
+                }
+                return false;
+            case Stream_Sections:
+                if (tag != NBT_Tag_Compound)
+                    return false;
+                loader->sections = grow_array(loader->sections, &loader->sections_capacity, loader->sections_count, sizeof(StreamSection));
+                loader->sections[loader->sections_count++] = (StreamSection) { 0 };
+                scope = Stream_Section;
+                break;
+            case Stream_Section: {
+                StreamSection* section = &loader->sections[loader->sections_count - 1];
+                if (tag == NBT_Tag_Byte && cunk_nbt_string_equals(name, "Y"))
+                    loader->field = Stream_Y;
+                else if (tag == NBT_Tag_ByteArray && cunk_nbt_string_equals(name, "Blocks"))
+                    loader->field = Stream_Blocks;
+                else if (tag == NBT_Tag_ByteArray && cunk_nbt_string_equals(name, "Data"))
+                    loader->field = Stream_LegacyData;
+                else if (tag == NBT_Tag_LongArray && cunk_nbt_string_equals(name, "BlockStates"))
+                    loader->field = Stream_LegacyStates;
+                else if (tag == NBT_Tag_List && cunk_nbt_string_equals(name, "Palette")) {
+                    loader->legacy_palette = true;
+                    section->legacy_palette_start = loader->names_count;
+                    scope = Stream_Palette;
+                    break;
+                } else if (tag == NBT_Tag_Compound && cunk_nbt_string_equals(name, "block_states")) {
+                    scope = Stream_BlockStates;
+                    break;
+                } else
+                    return false;
+                return true;
+            }
+            case Stream_BlockStates: {
+                StreamSection* section = &loader->sections[loader->sections_count - 1];
+                if (tag == NBT_Tag_LongArray && cunk_nbt_string_equals(name, "data")) {
+                    loader->field = Stream_States;
+                    return true;
+                }
+                if (tag == NBT_Tag_List && cunk_nbt_string_equals(name, "palette")) {
+                    loader->legacy_palette = false;
+                    section->palette_start = loader->names_count;
+                    scope = Stream_Palette;
+                    break;
+                }
+                return false;
+            }
+            case Stream_Palette:
+                if (tag != NBT_Tag_Compound)
+                    return false;
+                // entries without a name still take up a palette slot
+                loader->names = grow_array(loader->names, &loader->names_capacity, loader->names_count, sizeof(NBT_String));
+                loader->names[loader->names_count++] = (NBT_String) { 0 };
+                scope = Stream_PaletteEntry;
+                break;
+            case Stream_PaletteEntry:
+                if (tag == NBT_Tag_String && cunk_nbt_string_equals(name, "Name")) {
+                    loader->field = Stream_Name;
+                    return true;
+                }
+                return false;
+        }
+    }
+
+    // only compounds and lists get a scope of their own
+    if (tag != NBT_Tag_Compound && tag != NBT_Tag_List)
+        return false;
+    assert(loader->depth < STREAM_MAX_DEPTH);
+    loader->scopes[loader->depth++] = scope;
+    return true;
+}
+
+static void stream_leaf(StreamLoader* loader, NBT_Tag tag, const NBT_Body* body) {
+    (void) tag;
+    StreamSection* section = loader->sections_count > 0 ? &loader->sections[loader->sections_count - 1] : NULL;
+    switch (loader->field) {
+        case Stream_Ignore:
+            break;
+        case Stream_DataVersion:
+            loader->has_version = true;
+            loader->version = body->p_int;
+            break;
+        case Stream_Y:
+            section->has_y = true;
+            section->y = body->p_byte;
+            break;
+        case Stream_Blocks:
+            section->has_blocks = true;
+            section->blocks = body->p_byte_array;
+            break;
+        case Stream_LegacyData:
+            section->has_legacy_data = true;
+            section->legacy_data = body->p_byte_array;
+            break;
+        case Stream_LegacyStates:
+            section->has_legacy_states = true;
+            section->legacy_states = body->p_long_array;
+            break;
+        case Stream_States:
+            section->has_states = true;
+            section->states = body->p_long_array;
+            break;
+        case Stream_Name:
+            loader->names[loader->names_count - 1] = body->p_string;
+            break;
+    }
+    loader->field = Stream_Ignore;
+}
+
+/// The loader records what every format could have, modern picks the 1.18+ fields over the older ones
+static void decode_stream_section(ChunkData* dst_chunk, const StreamLoader* loader, const StreamSection* section, bool modern, SectionDecoder decode_section) {
+    assert(section->has_y);
+    int section_id = section_index(section->y);
+    if (section_id < 0)
+        return;
+
+    bool has_states = modern ? section->has_states : section->has_legacy_states;
+    size_t palette_start = modern ? section->palette_start : section->legacy_palette_start;
+    size_t palette_size = modern ? section->palette_size : section->legacy_palette_size;
+    SectionBlocks blocks = {
+        .blocks = section->has_blocks ? &section->blocks : NULL,
+        .meta = section->has_legacy_data ? &section->legacy_data : NULL,
+        .states = has_states ? (modern ? &section->states : &section->legacy_states) : NULL,
+        .palette_size = palette_size,
+        .palette = palette_size > 0 ? &loader->names[palette_start] : NULL,
+    };
+    decode_section(dst_chunk, section_id, &blocks);
+}
+
+/// Runs on leaving the root compound, while the views are still valid
+static void decode_stream_sections(StreamLoader* loader) {
+    // (DataVersion defaults to 0 in load_from_mcchunk as well)
+    ChunkFormat format = chunk_format(loader->version);
+    bool modern = format == Format_Sections;
+    assert(loader->has_level || modern);
+    assert(modern ? loader->has_sections : loader->has_legacy_sections);
+    SectionDecoder decode_section = section_decoders[format];
+    for (size_t i = 0; i < loader->sections_count; i++)
+        decode_stream_section(loader->dst_chunk, loader, &loader->sections[i], modern, decode_section);
+    loader->decoded = true;
+}
+
+static void stream_leave(StreamLoader* loader, NBT_Tag tag) {
+    (void) tag;
+    assert(loader->depth > 0);
+    StreamScope scope = loader->scopes[--loader->depth];
+    if (scope == Stream_Palette) {
+        StreamSection* section = &loader->sections[loader->sections_count - 1];
+        if (loader->legacy_palette)
+            section->legacy_palette_size = loader->names_count - section->legacy_palette_start;
+        else
+            section->palette_size = loader->names_count - section->palette_start;
+    }
+    if (loader->depth == 0)
+        decode_stream_sections(loader);
+}
+
+bool load_from_mcregion(ChunkData* dst_chunk, McRegion* region, unsigned int x, unsigned int z) {
+    StreamLoader loader = {
+        .visitor = {
+            .enter = (bool (*)(NBT_Visitor*, NBT_Tag, NBT_String, int32_t)) stream_enter,
+            .leaf = (void (*)(NBT_Visitor*, NBT_Tag, const NBT_Body*)) stream_leaf,
+            .leave = (void (*)(NBT_Visitor*, NBT_Tag)) stream_leave,
+        },
+        .dst_chunk = dst_chunk,
+    };
+
+    bool ok = cunk_visit_mcchunk(region, x, z, &loader.visitor) && loader.decoded;
+    free(loader.sections);
+    free(loader.names);
+    return ok;
+}
+
+static void destroy_section(ChunkSection*);
+
 void enkl_destroy_chunk_data(ChunkData* chunk) {
-    for (int section = 0; section < (CUNK_CHUNK_MAX_HEIGHT / CUNK_CHUNK_SIZE); section++) {
-        if (chunk->sections[section])
-            free(chunk->sections[section]);
+    for (int section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++) {
+        destroy_section(chunk->sections[section]);
+        chunk->sections[section] = NULL;
+    }
+    memset(chunk->column_min, 0, sizeof(chunk->column_min));
+    memset(chunk->column_max, 0, sizeof(chunk->column_max));
+    chunk->dirty_sections = 0;
+    memset(chunk->dirty_borders, 0, sizeof(chunk->dirty_borders));
+}
+
+/// Palettes larger than this don't fit in 8 bits and the section stores BlockData directly
+#define MAX_SECTION_PALETTE_SIZE 256
+
+static size_t section_palette_capacity(unsigned bits) {
+    return bits == 32 ? 0 : (size_t) 1 << bits;
+}
+
+static unsigned section_bits_for_palette(size_t palette_size) {
+    if (palette_size <= 1)
+        return 0;
+    if (palette_size <= 2)
+        return 1;
+    if (palette_size <= 4)
+        return 2;
+    if (palette_size <= 16)
+        return 4;
+    assert(palette_size <= MAX_SECTION_PALETTE_SIZE);
+    return 8;
+}
+
+#define SECTION_HEADER_SIZE ((sizeof(ChunkSection) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+static size_t section_palette_bytes(unsigned bits) {
+    return (section_palette_capacity(bits) * sizeof(BlockData) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+static size_t section_storage_size(unsigned bits) {
+    return SECTION_HEADER_SIZE + section_palette_bytes(bits) + CUNK_SECTION_BLOCKS_COUNT * bits / 8;
+}
+
+static unsigned section_size_class(unsigned bits) {
+    switch (bits) {
+        case 0: return 0;
+        case 1: return 1;
+        case 2: return 2;
+        case 4: return 3;
+        case 8: return 4;
+        case 32: return 5;
+        default: assert(false); return 0;
+    }
+}
+
+/// The palette and words are left uninitialized, whoever creates a section writes all of them (so recycled storage never needs clearing)
+static ChunkSection* create_section(unsigned bits) {
+    ChunkSection* section = enkl_section_pool_acquire(section_size_class(bits), section_storage_size(bits));
+    char* storage = (char*) section + SECTION_HEADER_SIZE;
+    size_t palette_size = section_palette_bytes(bits);
+    *section = (ChunkSection) {
+        .bits = (uint8_t) bits,
+        .palette = (BlockData*) storage,
+        .words = (uint64_t*) (storage + palette_size),
+    };
+    return section;
+}
+
+static void destroy_section(ChunkSection* section) {
+    if (section)
+        enkl_section_pool_release(section_size_class(section->bits), section_storage_size(section->bits), section);
+}
+
+_Static_assert(CUNK_CHUNK_SECTIONS_COUNT <= 32, "dirty bits are kept in an uint32_t");
+#define ALL_SECTIONS_MASK ((1u << (CUNK_CHUNK_SECTIONS_COUNT)) - 1)
+
+/// A whole section changed: itself, the ones above and below and its part of every border
+static void mark_section_dirty(ChunkData* chunk, unsigned sid) {
+    uint32_t bit = 1u << sid;
+    chunk->dirty_sections |= (bit | bit << 1 | bit >> 1) & ALL_SECTIONS_MASK;
+    for (int side = 0; side < 4; side++)
+        chunk->dirty_borders[side] |= bit;
+}
+
+/// Only the sections that can see the block at x, y, z
+static void mark_block_dirty(ChunkData* chunk, unsigned x, unsigned y, unsigned z) {
+    unsigned sid = y / CUNK_CHUNK_SIZE;
+    uint32_t bit = 1u << sid;
+    chunk->dirty_sections |= bit;
+    if (y % CUNK_CHUNK_SIZE == 0)
+        chunk->dirty_sections |= bit >> 1;
+    if (y % CUNK_CHUNK_SIZE == CUNK_CHUNK_SIZE - 1)
+        chunk->dirty_sections |= (bit << 1) & ALL_SECTIONS_MASK;
+    if (x == 0)
+        chunk->dirty_borders[WEST] |= bit;
+    if (x == CUNK_CHUNK_SIZE - 1)
+        chunk->dirty_borders[EAST] |= bit;
+    if (z == 0)
+        chunk->dirty_borders[NORTH] |= bit;
+    if (z == CUNK_CHUNK_SIZE - 1)
+        chunk->dirty_borders[SOUTH] |= bit;
+}
+
+static void replace_section(ChunkData* chunk, unsigned sid, ChunkSection* section) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT);
+    if (!chunk->sections[sid] && !section)
+        return;
+    destroy_section(chunk->sections[sid]);
+    chunk->sections[sid] = section;
+    mark_section_dirty(chunk, sid);
+}
+
+// The loops below take the width as a parameter but are always called with a constant, so each width gets its own copy.
+static inline void pack_section_entries(uint64_t* words, unsigned bits, const uint16_t* entries) {
+    const unsigned per_word = 64 / bits;
+    for (size_t w = 0; w < CUNK_SECTION_BLOCKS_COUNT / per_word; w++) {
+        uint64_t word = 0;
+        for (unsigned j = 0; j < per_word; j++)
+            word |= (uint64_t) entries[w * per_word + j] << (j * bits);
+        words[w] = word;
+    }
+}
+
+static inline void unpack_section_entries(const uint64_t* words, unsigned bits, uint16_t* entries) {
+    const unsigned per_word = 64 / bits;
+    const uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    for (size_t w = 0; w < CUNK_SECTION_BLOCKS_COUNT / per_word; w++) {
+        uint64_t word = words[w];
+        for (unsigned j = 0; j < per_word; j++) {
+            *entries++ = (uint16_t) (word & mask);
+            word >>= bits;
+        }
     }
 }
 
+static inline void expand_section_blocks(const uint64_t* words, unsigned bits, const BlockData* palette, BlockData* dst) {
+    const unsigned per_word = 64 / bits;
+    const uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    for (size_t w = 0; w < CUNK_SECTION_BLOCKS_COUNT / per_word; w++) {
+        uint64_t word = words[w];
+        for (unsigned j = 0; j < per_word; j++) {
+            *dst++ = palette[word & mask];
+            word >>= bits;
+        }
+    }
+}
+
+#define SECTION_PACKED_WIDTHS(W) W(1) W(2) W(4) W(8)
+
+static void pack_section(ChunkSection* section, const uint16_t* entries) {
+    switch (section->bits) {
+#define W(BITS) case BITS: pack_section_entries(section->words, BITS, entries); break;
+SECTION_PACKED_WIDTHS(W)
+#undef W
+        default: assert(false);
+    }
+}
+
+static void unpack_section(const ChunkSection* section, uint16_t* entries) {
+    switch (section->bits) {
+        case 0: memset(entries, 0, sizeof(uint16_t) * CUNK_SECTION_BLOCKS_COUNT); break;
+#define W(BITS) case BITS: unpack_section_entries(section->words, BITS, entries); break;
+SECTION_PACKED_WIDTHS(W)
+#undef W
+        default: assert(false);
+    }
+}
+
+static void extend_column_bounds(ChunkData* chunk, unsigned column, unsigned bottom, unsigned top) {
+    if (chunk->column_max[column] <= chunk->column_min[column]) {
+        chunk->column_min[column] = (uint16_t) bottom;
+        chunk->column_max[column] = (uint16_t) top;
+        return;
+    }
+    if (bottom < chunk->column_min[column])
+        chunk->column_min[column] = (uint16_t) bottom;
+    if (top > chunk->column_max[column])
+        chunk->column_max[column] = (uint16_t) top;
+}
+
+/// Widens the bounds of every column to its lowest and highest non-air entries in the section
+static void extend_section_bounds(ChunkData* chunk, unsigned sid, size_t palette_size, const BlockData* palette, const uint16_t* entries) {
+    unsigned base = sid * CUNK_CHUNK_SIZE;
+    size_t air = 0;
+    while (air < palette_size && palette[air] != air_data)
+        air++;
+    if (air == palette_size) {
+        for (unsigned column = 0; column < CUNK_CHUNK_COLUMNS_COUNT; column++)
+            extend_column_bounds(chunk, column, base, base + CUNK_CHUNK_SIZE);
+        return;
+    }
+    for (unsigned column = 0; column < CUNK_CHUNK_COLUMNS_COUNT; column++) {
+        unsigned bottom = 0, top = CUNK_CHUNK_SIZE;
+        while (bottom < CUNK_CHUNK_SIZE && entries[bottom * CUNK_CHUNK_COLUMNS_COUNT + column] == air)
+            bottom++;
+        if (bottom == CUNK_CHUNK_SIZE)
+            continue;
+        while (entries[(top - 1) * CUNK_CHUNK_COLUMNS_COUNT + column] == air)
+            top--;
+        extend_column_bounds(chunk, column, base + bottom, base + top);
+    }
+}
+
+static void extend_direct_section_bounds(ChunkData* chunk, unsigned sid, const BlockData* blocks) {
+    unsigned base = sid * CUNK_CHUNK_SIZE;
+    for (unsigned column = 0; column < CUNK_CHUNK_COLUMNS_COUNT; column++) {
+        unsigned bottom = 0, top = CUNK_CHUNK_SIZE;
+        while (bottom < CUNK_CHUNK_SIZE && blocks[bottom * CUNK_CHUNK_COLUMNS_COUNT + column] == air_data)
+            bottom++;
+        if (bottom == CUNK_CHUNK_SIZE)
+            continue;
+        while (blocks[(top - 1) * CUNK_CHUNK_COLUMNS_COUNT + column] == air_data)
+            top--;
+        extend_column_bounds(chunk, column, base + bottom, base + top);
+    }
+}
+
+/// Stores the blocks given as entries into a palette without duplicates, a uniform air section is simply left out.
+static void store_section(ChunkData* chunk, unsigned sid, size_t palette_size, const BlockData* palette, const uint16_t* entries) {
+    unsigned bits = section_bits_for_palette(palette_size);
+    if (bits == 0 && palette[0] == air_data) {
+        replace_section(chunk, sid, NULL);
+        return;
+    }
+    ChunkSection* section = create_section(bits);
+    section->palette_size = (uint16_t) palette_size;
+    memcpy(section->palette, palette, sizeof(BlockData) * palette_size);
+    if (bits > 0)
+        pack_section(section, entries);
+    replace_section(chunk, sid, section);
+    extend_section_bounds(chunk, sid, palette_size, palette, entries);
+}
+
+static void store_direct_section(ChunkData* chunk, unsigned sid, const BlockData* blocks) {
+    ChunkSection* section = create_section(32);
+    memcpy(section->words, blocks, sizeof(BlockData) * CUNK_SECTION_BLOCKS_COUNT);
+    replace_section(chunk, sid, section);
+    extend_direct_section_bounds(chunk, sid, blocks);
+}
+
+void chunk_set_section_blocks(ChunkData* chunk, unsigned sid, const BlockData* blocks) {
+    BlockData palette[MAX_SECTION_PALETTE_SIZE];
+    size_t palette_size = 0;
+    uint16_t entries[CUNK_SECTION_BLOCKS_COUNT];
+    size_t last = 0;
+    for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++) {
+        BlockData block = blocks[pos];
+        // runs of the same block are the common case
+        if (palette_size == 0 || palette[last] != block) {
+            for (last = 0; last < palette_size && palette[last] != block; last++);
+            if (last == palette_size) {
+                if (palette_size == MAX_SECTION_PALETTE_SIZE) {
+                    store_direct_section(chunk, sid, blocks);
+                    return;
+                }
+                palette[palette_size++] = block;
+            }
+        }
+        entries[pos] = (uint16_t) last;
+    }
+    store_section(chunk, sid, palette_size, palette, entries);
+}
+
+void chunk_set_section_paletted(ChunkData* chunk, unsigned sid, size_t palette_size, const BlockData* palette, const uint16_t* indices) {
+    assert(palette_size > 0);
+    // only keep the entries that are used, once each
+    uint16_t remap[palette_size];
+    bool used[palette_size];
+    memset(used, 0, sizeof(used));
+    for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++) {
+        unsigned index = indices[pos];
+        assert(index < palette_size);
+        if (index >= palette_size)
+            index %= palette_size;
+        used[index] = true;
+    }
+
+    BlockData unique[MAX_SECTION_PALETTE_SIZE];
+    size_t unique_count = 0;
+    for (size_t i = 0; i < palette_size; i++) {
+        if (!used[i])
+            continue;
+        size_t j;
+        for (j = 0; j < unique_count && unique[j] != palette[i]; j++);
+        if (j == unique_count) {
+            if (unique_count == MAX_SECTION_PALETTE_SIZE) {
+                BlockData blocks[CUNK_SECTION_BLOCKS_COUNT];
+                for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++)
+                    blocks[pos] = palette[indices[pos] % palette_size];
+                store_direct_section(chunk, sid, blocks);
+                return;
+            }
+            unique[unique_count++] = palette[i];
+        }
+        remap[i] = (uint16_t) j;
+    }
+
+    uint16_t entries[CUNK_SECTION_BLOCKS_COUNT];
+    for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++) {
+        unsigned index = indices[pos];
+        if (index >= palette_size)
+            index %= palette_size;
+        entries[pos] = remap[index];
+    }
+    store_section(chunk, sid, unique_count, unique, entries);
+}
+
+void chunk_set_section_uniform(ChunkData* chunk, unsigned sid, BlockData block) {
+    store_section(chunk, sid, 1, &block, NULL);
+}
+
+bool chunk_section_uniform_block(const ChunkData* chunk, unsigned sid, BlockData* block) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT);
+    const ChunkSection* section = chunk->sections[sid];
+    if (section && section->bits != 0)
+        return false;
+    *block = section ? section->palette[0] : air_data;
+    return true;
+}
+
+void chunk_read_section_blocks(const ChunkData* chunk, unsigned sid, BlockData* dst) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT);
+    const ChunkSection* section = chunk->sections[sid];
+    if (!section || section->bits == 0) {
+        BlockData block = section ? section->palette[0] : air_data;
+        for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++)
+            dst[pos] = block;
+        return;
+    }
+    switch (section->bits) {
+        case 32: memcpy(dst, section->words, sizeof(BlockData) * CUNK_SECTION_BLOCKS_COUNT); break;
+#define W(BITS) case BITS: expand_section_blocks(section->words, BITS, section->palette, dst); break;
+SECTION_PACKED_WIDTHS(W)
+#undef W
+        default: assert(false);
+    }
+}
+
+ChunkSectionView chunk_get_section_view(const ChunkData* chunk, unsigned sid) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT);
+    const ChunkSection* section = chunk->sections[sid];
+    if (!section)
+        return (ChunkSectionView) { .kind = ChunkSectionNull, .palette_size = 1, .palette = &air_data };
+    ChunkSectionView view = {
+        .bits = section->bits,
+        .palette_size = section->palette_size,
+        .palette = section->palette,
+        .words = section->bits > 0 ? section->words : NULL,
+    };
+    switch (section->bits) {
+        case 0: view.kind = ChunkSectionUniform; break;
+        case 32: view.kind = ChunkSectionDirect; view.palette_size = 0; view.palette = NULL; break;
+        default: view.kind = ChunkSectionPaletted; break;
+    }
+    return view;
+}
+
+/// Fetches count blocks starting at pos, stride entries apart. Called with a constant width, like the loops above.
+static inline void gather_section_entries(const uint64_t* words, unsigned bits, const BlockData* palette, size_t pos, size_t stride, size_t count, BlockData* dst) {
+    const uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    for (size_t i = 0; i < count; i++, pos += stride) {
+        size_t bit = pos * bits;
+        dst[i] = palette[(words[bit / 64] >> (bit % 64)) & mask];
+    }
+}
+
+static void gather_section(const ChunkSection* section, size_t pos, size_t stride, size_t count, BlockData* dst) {
+    if (!section || section->bits == 0) {
+        BlockData block = section ? section->palette[0] : air_data;
+        for (size_t i = 0; i < count; i++)
+            dst[i] = block;
+        return;
+    }
+    switch (section->bits) {
+        case 32: {
+            const BlockData* blocks = (const BlockData*) section->words;
+            for (size_t i = 0; i < count; i++, pos += stride)
+                dst[i] = blocks[pos];
+            break;
+        }
+#define W(BITS) case BITS: gather_section_entries(section->words, BITS, section->palette, pos, stride, count, dst); break;
+SECTION_PACKED_WIDTHS(W)
+#undef W
+        default: assert(false);
+    }
+}
+
+void chunk_read_section_layer(const ChunkData* chunk, unsigned sid, unsigned y, BlockData* dst) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT && y < CUNK_CHUNK_SIZE);
+    gather_section(chunk->sections[sid], y * CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE, 1, CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE, dst);
+}
+
+void chunk_read_section_x_slice(const ChunkData* chunk, unsigned sid, unsigned x, BlockData* dst) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT && x < CUNK_CHUNK_SIZE);
+    // x is the fastest axis, so y, z pairs are CUNK_CHUNK_SIZE entries apart all the way through
+    gather_section(chunk->sections[sid], x, CUNK_CHUNK_SIZE, CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE, dst);
+}
+
+void chunk_read_section_z_slice(const ChunkData* chunk, unsigned sid, unsigned z, BlockData* dst) {
+    assert(sid < CUNK_CHUNK_SECTIONS_COUNT && z < CUNK_CHUNK_SIZE);
+    for (unsigned y = 0; y < CUNK_CHUNK_SIZE; y++)
+        gather_section(chunk->sections[sid], (y * CUNK_CHUNK_SIZE + z) * CUNK_CHUNK_SIZE, 1, CUNK_CHUNK_SIZE, dst + y * CUNK_CHUNK_SIZE);
+}
+
+void chunk_read_column(const ChunkData* chunk, unsigned x, unsigned z, BlockData* dst) {
+    assert(x < CUNK_CHUNK_SIZE && z < CUNK_CHUNK_SIZE);
+    for (unsigned sid = 0; sid < CUNK_CHUNK_SECTIONS_COUNT; sid++)
+        gather_section(chunk->sections[sid], z * CUNK_CHUNK_SIZE + x, CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE, CUNK_CHUNK_SIZE, dst + sid * CUNK_CHUNK_SIZE);
+}
+
+/// Moves the section to the next width up, or to storing BlockData directly once the palette would outgrow 8 bits
+static ChunkSection* widen_section(ChunkSection* old) {
+    unsigned bits = old->bits == 0 ? 1 : old->bits == 8 ? 32 : old->bits * 2;
+    ChunkSection* section = create_section(bits);
+    if (bits == 32) {
+        BlockData* blocks = (BlockData*) section->words;
+        for (size_t pos = 0; pos < CUNK_SECTION_BLOCKS_COUNT; pos++) {
+            unsigned bit = pos * old->bits;
+            blocks[pos] = old->palette[(old->words[bit / 64] >> (bit % 64)) & 0xFF];
+        }
+    } else {
+        uint16_t entries[CUNK_SECTION_BLOCKS_COUNT];
+        unpack_section(old, entries);
+        pack_section(section, entries);
+        section->palette_size = old->palette_size;
+        memcpy(section->palette, old->palette, sizeof(BlockData) * old->palette_size);
+    }
+    destroy_section(old);
+    return section;
+}
+
 BlockData chunk_get_block_data(const ChunkData* chunk, unsigned x, unsigned y, unsigned z) {
     assert(x < CUNK_CHUNK_SIZE && z < CUNK_CHUNK_SIZE && y < CUNK_CHUNK_MAX_HEIGHT);
     const ChunkSection* section = chunk->sections[y / CUNK_CHUNK_SIZE];
-    y %= CUNK_CHUNK_SIZE;
-    if (section)
-        return section->block_data[y][z][x];
-    return air_data;
+    if (!section)
+        return air_data;
+    unsigned pos = ((y % CUNK_CHUNK_SIZE) * CUNK_CHUNK_SIZE + z) * CUNK_CHUNK_SIZE + x;
+    switch (section->bits) {
+        case 0: return section->palette[0];
+        case 32: return ((const BlockData*) section->words)[pos];
+        default: {
+            unsigned bit = pos * section->bits;
+            unsigned mask = (1u << section->bits) - 1;
+            return section->palette[(section->words[bit / 64] >> (bit % 64)) & mask];
+        }
+    }
 }
 
 void chunk_set_block_data(ChunkData* chunk, unsigned x, unsigned y, unsigned z, BlockData data) {
     assert(x < CUNK_CHUNK_SIZE && z < CUNK_CHUNK_SIZE && y < CUNK_CHUNK_MAX_HEIGHT);
     unsigned sid = y / CUNK_CHUNK_SIZE;
     ChunkSection* section = chunk->sections[sid];
-    y %= CUNK_CHUNK_SIZE;
-    if (!section)
-        section = chunk->sections[sid] = calloc(CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE * CUNK_CHUNK_SIZE, sizeof(BlockData));
-    section->block_data[y][z][x] = data;
+    unsigned pos = ((y % CUNK_CHUNK_SIZE) * CUNK_CHUNK_SIZE + z) * CUNK_CHUNK_SIZE + x;
+    if (!section) {
+        if (data == air_data)
+            return;
+        section = chunk->sections[sid] = create_section(0);
+        section->palette_size = 1;
+        section->palette[0] = air_data;
+    } else if (chunk_get_block_data(chunk, x, y, z) == data)
+        return;
+    if (data != air_data)
+        extend_column_bounds(chunk, z * CUNK_CHUNK_SIZE + x, y, y + 1);
+    mark_block_dirty(chunk, x, y, z);
+
+    unsigned entry = 0;
+    if (section->bits != 32) {
+        while (entry < section->palette_size && section->palette[entry] != data)
+            entry++;
+        if (entry == section->palette_size) {
+            if (section->palette_size == section_palette_capacity(section->bits))
+                section = chunk->sections[sid] = widen_section(section);
+            if (section->bits != 32)
+                section->palette[section->palette_size++] = data;
+        }
+    }
+
+    switch (section->bits) {
+        case 0: break;
+        case 32: ((BlockData*) section->words)[pos] = data; break;
+        default: {
+            unsigned bit = pos * section->bits;
+            uint64_t mask = (((uint64_t) 1 << section->bits) - 1) << (bit % 64);
+            section->words[bit / 64] = (section->words[bit / 64] & ~mask) | ((uint64_t) entry << (bit % 64));
+        }
+    }
 }
@@ -0,0 +1,213 @@
+#include "block_registry.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/// Flattened names and the block they stand for, several names may share a block
+#define FLATTENED_BLOCKS(N) \
+N("minecraft:air", Air) \
+N("minecraft:stone", Stone) \
+N("minecraft:grass", Grass) \
+N("minecraft:dirt", Dirt) \
+N("minecraft:cobblestone", CobbleStone) \
+N("minecraft:planks", Planks) \
+N("minecraft:water", Water) \
+N("minecraft:flowing_water", Water) \
+N("minecraft:lava", Lava) \
+N("minecraft:flowing_lava", Lava) \
+N("minecraft:sand", Sand) \
+N("minecraft:gravel", Gravel) \
+N("minecraft:log", Wood) \
+N("minecraft:log2", Wood) \
+N("minecraft:leaves", Leaves) \
+N("minecraft:leaves2", Leaves) \
+N("minecraft:sandstone", SandStone) \
+N("minecraft:tallgrass", TallGrass) \
+N("minecraft:snow_layer", Snow) \
+N("minecraft:snow", Snow) \
+N("minecraft:white_terracotta", WhiteTerracotta) \
+N("minecraft:quartz_block", Quartz) \
+N("minecraft:yellow_flower", Dandelion) \
+N("minecraft:mossy_cobblestone", MossyCobbleStone)
+
+/// Pre-flattening numeric ids, meta -1 covers every variant of the id, specific metas override it
+#define LEGACY_BLOCKS(L) \
+L(0, -1, Air) \
+L(1, -1, Stone) \
+L(2, -1, Grass) \
+L(3, -1, Dirt) \
+L(4, -1, CobbleStone) \
+L(5, -1, Planks) \
+L(8, -1, Water) \
+L(9, -1, Water) \
+L(10, -1, Lava) \
+L(11, -1, Lava) \
+L(12, -1, Sand) \
+L(13, -1, Gravel) \
+L(17, -1, Wood) \
+L(162, -1, Wood) \
+L(18, -1, Leaves) \
+L(161, -1, Leaves) \
+L(24, -1, SandStone) \
+L(31, -1, TallGrass) \
+L(37, -1, Dandelion) \
+L(48, -1, MossyCobbleStone) \
+L(78, -1, Snow) \
+L(80, -1, Snow) \
+L(159, -1, WhiteTerracotta) \
+L(155, -1, Quartz)
+
+typedef struct {
+    const char* name;
+    uint16_t length;
+    BlockData block;
+} FlattenedBlock;
+
+static const FlattenedBlock flattened_blocks[] = {
+#define N(name, block) { name, sizeof(name) - 1, Block##block },
+FLATTENED_BLOCKS(N)
+#undef N
+};
+
+#define FLATTENED_BLOCKS_COUNT (sizeof(flattened_blocks) / sizeof(flattened_blocks[0]))
+
+// Room for a block list a few hundred names long, the table is kept at most half full
+#define REGISTRY_MAX_SLOTS 2048
+#define REGISTRY_MAX_BUCKETS 1024
+// A bucket that still doesn't fit after this many tries has names that hash the same
+#define REGISTRY_MAX_DISPLACEMENT (1u << 24)
+static_assert(FLATTENED_BLOCKS_COUNT * 2 <= REGISTRY_MAX_SLOTS, "grow the registry");
+
+/// Perfect hash over the flattened names (hash and displace): the name hash picks a bucket, and each bucket has a displacement
+/// that was chosen so that all of its names land in distinct free slots. A lookup is then one hash, two loads and a memcmp.
+static struct {
+    uint32_t slots_mask, buckets_mask;
+    uint32_t displacements[REGISTRY_MAX_BUCKETS];
+    /// index into flattened_blocks + 1, 0 is empty
+    uint16_t slots[REGISTRY_MAX_SLOTS];
+} registry;
+
+static BlockData legacy_blocks[ENKL_LEGACY_BLOCKS_COUNT];
+
+static once_flag registry_once = ONCE_FLAG_INIT;
+
+static uint32_t mix_hash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t registry_slot(uint32_t hash) {
+    return mix_hash(hash ^ registry.displacements[hash & registry.buckets_mask]) & registry.slots_mask;
+}
+
+static uint32_t next_power_of_two(uint32_t n) {
+    uint32_t p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
+
+static void init_flattened_registry(void) {
+    size_t count = FLATTENED_BLOCKS_COUNT;
+    uint32_t hashes[FLATTENED_BLOCKS_COUNT];
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = cunk_nbt_hash_string((NBT_String) { flattened_blocks[i].length, flattened_blocks[i].name });
+        // names that hash the same can't be told apart by any displacement
+        for (size_t j = 0; j < i; j++)
+            assert(hashes[j] != hashes[i]);
+    }
+
+    uint32_t slots_count = next_power_of_two(count * 2);
+    uint32_t buckets_count = next_power_of_two((count + 1) / 2);
+    registry.slots_mask = slots_count - 1;
+    registry.buckets_mask = buckets_count - 1;
+
+    size_t bucket_sizes[REGISTRY_MAX_BUCKETS] = { 0 };
+    size_t largest_bucket = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t size = ++bucket_sizes[hashes[i] & registry.buckets_mask];
+        if (size > largest_bucket)
+            largest_bucket = size;
+    }
+
+    // place the fullest buckets first, while there's still plenty of room
+    for (size_t size = largest_bucket; size > 0; size--) {
+        for (uint32_t bucket = 0; bucket < buckets_count; bucket++) {
+            if (bucket_sizes[bucket] != size)
+                continue;
+            size_t members[FLATTENED_BLOCKS_COUNT];
+            size_t members_count = 0;
+            for (size_t i = 0; i < count; i++)
+                if ((hashes[i] & registry.buckets_mask) == bucket)
+                    members[members_count++] = i;
+
+            for (uint32_t displacement = 0;; displacement++) {
+                if (displacement == REGISTRY_MAX_DISPLACEMENT) {
+                    fprintf(stderr, "enklume: can't place the block names of registry bucket %u, check FLATTENED_BLOCKS for hash collisions\n", bucket);
+                    abort();
+                }
+                registry.displacements[bucket] = displacement;
+                uint32_t taken[FLATTENED_BLOCKS_COUNT];
+                bool fits = true;
+                for (size_t m = 0; m < members_count && fits; m++) {
+                    taken[m] = registry_slot(hashes[members[m]]);
+                    fits = registry.slots[taken[m]] == 0;
+                    for (size_t other = 0; other < m && fits; other++)
+                        fits = taken[other] != taken[m];
+                }
+                if (!fits)
+                    continue;
+                for (size_t m = 0; m < members_count; m++)
+                    registry.slots[taken[m]] = (uint16_t) (members[m] + 1);
+                break;
+            }
+        }
+    }
+}
+
+static void init_legacy_table(void) {
+    for (size_t i = 0; i < ENKL_LEGACY_BLOCKS_COUNT; i++)
+        legacy_blocks[i] = BlockUnknown;
+#define L(id, meta, block) if (meta < 0) for (int m = 0; m < 16; m++) legacy_blocks[id << 4 | m] = Block##block;
+LEGACY_BLOCKS(L)
+#undef L
+#define L(id, meta, block) if (meta >= 0) legacy_blocks[id << 4 | (meta & 15)] = Block##block;
+LEGACY_BLOCKS(L)
+#undef L
+}
+
+static void init_registry(void) {
+    init_flattened_registry();
+    init_legacy_table();
+}
+
+static BlockData lookup_flattened_block(NBT_String name, uint32_t hash) {
+    uint16_t entry = registry.slots[registry_slot(hash)];
+    if (entry == 0)
+        return BlockUnknown;
+    const FlattenedBlock* block = &flattened_blocks[entry - 1];
+    if (block->length != name.length || memcmp(block->name, name.chars, name.length) != 0)
+        return BlockUnknown;
+    return block->block;
+}
+
+void enkl_decode_block_palette(size_t count, const NBT_String* names, BlockData* decoded) {
+    if (count == 0)
+        return;
+    call_once(&registry_once, init_registry);
+
+    for (size_t i = 0; i < count; i++)
+        decoded[i] = lookup_flattened_block(names[i], cunk_nbt_hash_string(names[i]));
+}
+
+const BlockData* enkl_get_legacy_block_table(void) {
+    call_once(&registry_once, init_registry);
+    return legacy_blocks;
+}
@@ -0,0 +1,14 @@
+#ifndef ENKL_BLOCK_REGISTRY_H
+#define ENKL_BLOCK_REGISTRY_H
+
+#include "enklume/nbt.h"
+#include "enklume/block_data.h"
+
+/// Resolves the flattened ("minecraft:...") names of a palette.
+void enkl_decode_block_palette(size_t count, const NBT_String* names, BlockData* decoded);
+
+/// Pre-flattening blocks, indexed by id << 4 | meta
+#define ENKL_LEGACY_BLOCKS_COUNT (256 * 16)
+const BlockData* enkl_get_legacy_block_table(void);
+
+#endif
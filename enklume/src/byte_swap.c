@@ -0,0 +1,110 @@
+#include "support_private.h"
+
+#include <string.h>
+#include <threads.h>
+
+static void swap_32_scalar(uint8_t* dst, const uint8_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value;
+        memcpy(&value, src + i * sizeof(uint32_t), sizeof(uint32_t));
+        value = enkl_bswap32(value);
+        memcpy(dst + i * sizeof(uint32_t), &value, sizeof(uint32_t));
+    }
+}
+
+static void swap_64_scalar(uint8_t* dst, const uint8_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t value;
+        memcpy(&value, src + i * sizeof(uint64_t), sizeof(uint64_t));
+        value = enkl_bswap64(value);
+        memcpy(dst + i * sizeof(uint64_t), &value, sizeof(uint64_t));
+    }
+}
+
+static void (*swap_32_kernel)(uint8_t*, const uint8_t*, size_t) = swap_32_scalar;
+static void (*swap_64_kernel)(uint8_t*, const uint8_t*, size_t) = swap_64_scalar;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+// the byte shuffles reversing each 4 or 8 byte lane of a 16 byte vector
+#define SHUFFLE_32 _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)
+#define SHUFFLE_64 _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7)
+
+__attribute__((target("ssse3")))
+static size_t swap_ssse3(uint8_t* dst, const uint8_t* src, size_t size, __m128i shuffle) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(v, shuffle));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t swap_avx2(uint8_t* dst, const uint8_t* src, size_t size, __m128i shuffle) {
+    // vpshufb shuffles within each 128 bit half, so the same pattern goes in both
+    __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + i + 32));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(a, shuffle2));
+        _mm256_storeu_si256((__m256i*) (dst + i + 32), _mm256_shuffle_epi8(b, shuffle2));
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (src + i));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(a, shuffle2));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static void swap_32_ssse3(uint8_t* dst, const uint8_t* src, size_t count) {
+    size_t done = swap_ssse3(dst, src, count * sizeof(uint32_t), SHUFFLE_32) / sizeof(uint32_t);
+    swap_32_scalar(dst + done * sizeof(uint32_t), src + done * sizeof(uint32_t), count - done);
+}
+
+__attribute__((target("ssse3")))
+static void swap_64_ssse3(uint8_t* dst, const uint8_t* src, size_t count) {
+    size_t done = swap_ssse3(dst, src, count * sizeof(uint64_t), SHUFFLE_64) / sizeof(uint64_t);
+    swap_64_scalar(dst + done * sizeof(uint64_t), src + done * sizeof(uint64_t), count - done);
+}
+
+__attribute__((target("avx2")))
+static void swap_32_avx2(uint8_t* dst, const uint8_t* src, size_t count) {
+    size_t done = swap_avx2(dst, src, count * sizeof(uint32_t), SHUFFLE_32) / sizeof(uint32_t);
+    swap_32_ssse3(dst + done * sizeof(uint32_t), src + done * sizeof(uint32_t), count - done);
+}
+
+__attribute__((target("avx2")))
+static void swap_64_avx2(uint8_t* dst, const uint8_t* src, size_t count) {
+    size_t done = swap_avx2(dst, src, count * sizeof(uint64_t), SHUFFLE_64) / sizeof(uint64_t);
+    swap_64_ssse3(dst + done * sizeof(uint64_t), src + done * sizeof(uint64_t), count - done);
+}
+
+static void select_kernels(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        swap_32_kernel = swap_32_avx2;
+        swap_64_kernel = swap_64_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        swap_32_kernel = swap_32_ssse3;
+        swap_64_kernel = swap_64_ssse3;
+    }
+}
+#else
+static void select_kernels(void) {}
+#endif
+
+static once_flag kernels_once = ONCE_FLAG_INIT;
+
+void enkl_swap_endianness_32(void* dst, const void* src, size_t count) {
+    call_once(&kernels_once, select_kernels);
+    swap_32_kernel(dst, src, count);
+}
+
+void enkl_swap_endianness_64(void* dst, const void* src, size_t count) {
+    call_once(&kernels_once, select_kernels);
+    swap_64_kernel(dst, src, count);
+}
@@ -3,13 +3,26 @@
 #include "support_private.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
 #include <stdalign.h>
+#include <string.h>
+#include <threads.h>
+
+/// Chunk trees are decoded into arenas of this size, arenas that outgrow it get resized on recycling
+#define CHUNK_ARENA_BLOCK_SIZE (256 * 1024)
+#define MAX_SPARE_CHUNK_ARENAS 32
 
 struct McWorld_ {
     Enkl_Allocator* allocator;
     const char* path;
+    bool chunk_views;
+
+    /// arenas of closed chunks, ready to be reused by the next opened chunk
+    mtx_t arenas_lock;
+    size_t spare_arenas_count;
+    Enkl_Arena* spare_arenas[MAX_SPARE_CHUNK_ARENAS];
 };
 
 McWorld* cunk_open_mcworld(const char* folder, Enkl_Allocator* allocator) {
@@ -25,21 +38,24 @@ McWorld* cunk_open_mcworld(const char* folder, Enkl_Allocator* allocator) {
         .allocator = allocator,
         .path = enkl_copy_string(folder, allocator),
     };
+    mtx_init(&world->arenas_lock, mtx_plain);
     return world;
 }
 
 void cunk_close_mcworld(McWorld* w) {
+    for (size_t i = 0; i < w->spare_arenas_count; i++)
+        enkl_destroy_arena(w->spare_arenas[i]);
+    mtx_destroy(&w->arenas_lock);
     w->allocator->free_bytes(w->allocator, (void*) w->path);
     w->allocator->free_bytes(w->allocator, w);
 }
 
-typedef union {
-    struct {
-        unsigned offset: 24;
-        unsigned sector_count: 8;
-    };
-    uint32_t word;
-} ChunkLocation;
+void cunk_mcworld_set_chunk_views(McWorld* w, bool enabled) {
+    w->chunk_views = enabled;
+}
+
+/// big-endian 3 byte sector offset followed by a 1 byte sector count
+typedef uint32_t ChunkLocation;
 
 typedef uint32_t ChunkTimestamp;
 
@@ -48,22 +64,72 @@ typedef struct {
     ChunkTimestamp timestamps[32][32];
 } McRegionHeader;
 
-static_assert(sizeof(ChunkLocation) == sizeof(int32_t), "some unwanted padding made it in :/");
+static_assert(sizeof(McRegionHeader) == 8192, "some unwanted padding made it in :/");
 
 typedef enum {
-    Compr_INVALID, Compr_GZip, Compr_Zlib, Compr_Uncompressed
+    Compr_INVALID, Compr_GZip, Compr_Zlib, Compr_Uncompressed, Compr_LZ4
 } McChunkCompression;
 
+/// Set on the compression type of oversized chunks, whose payload lives in a separate c.X.Z.mcc file instead
+#define COMPR_EXTERNAL_BIT 0x80
+
 typedef struct {
     uint32_t length;
     uint8_t compression_type;
     const char* compressed_data;
 } McRegionPayload;
 
+/// Chunks whose first sector overlaps the header or lies past the end of the file count as absent.
+/// Their last sector may well run past it though: before 1.14 the end of region files wasn't padded to a whole sector.
+static void decode_region_header(const McRegionHeader* big_endian_header, size_t file_size, McRegionIndex* index) {
+    for (int cz = 0; cz < 32; cz++) {
+        index->present[cz] = 0;
+        for (int cx = 0; cx < 32; cx++) {
+            // once swapped, the sector count ends up in the low byte
+            uint32_t location = enkl_swap_endianness(4, big_endian_header->locations[cz][cx]);
+            index->sector_offsets[cz][cx] = location >> 8;
+            index->sector_counts[cz][cx] = location & 0xFF;
+            index->timestamps[cz][cx] = enkl_swap_endianness(4, big_endian_header->timestamps[cz][cx]);
+            bool in_file = index->sector_offsets[cz][cx] >= 2 && (size_t) index->sector_offsets[cz][cx] * 4096 < file_size;
+            if (index->sector_counts[cz][cx] > 0 && in_file)
+                index->present[cz] |= 1u << cx;
+        }
+    }
+}
+
+bool cunk_scan_mcregion_index(McWorld* world, int x, int z, McRegionIndex* out) {
+    const char* path = enkl_format_string("%s/region/r.%d.%d.mca", world->path, x, z);
+    FILE* f = fopen(path, "rb");
+    free((char*) path);
+    if (!f)
+        return false;
+
+    McRegionHeader big_endian_header;
+    size_t read = fread(&big_endian_header, 1, sizeof(big_endian_header), f);
+    bool sized = fseek(f, 0, SEEK_END) == 0;
+    long file_size = ftell(f);
+    fclose(f);
+    if (read != sizeof(big_endian_header) || !sized || file_size < 0)
+        return false;
+
+    decode_region_header(&big_endian_header, (size_t) file_size, out);
+    return true;
+}
+
+bool cunk_mcregion_index_has_chunk(const McRegionIndex* index, unsigned int x, unsigned int z) {
+    assert(x < 32 && z < 32);
+    return (index->present[z] >> x) & 1;
+}
+
 struct McRegion_ {
     McWorld* world;
-    char* bytes;
-    McRegionHeader decoded_header;
+    int x, z;
+    const char* bytes;
+    size_t size;
+    /// bytes is a read-only file mapping rather than a heap copy of the file
+    bool mapped;
+    McRegionIndex index;
+    /// decoded lazily, see fetch_payload
     McRegionPayload decoded_payloads[32][32];
 };
 
@@ -73,46 +139,40 @@ McRegion* cunk_open_mcregion(McWorld* world, int x, int z) {
         goto fail;
 
     size_t size;
-    void* contents;
-    if (!enkl_read_file(path, &size, (char**) &contents, world->allocator))
+    const char* contents;
+    bool mapped = enkl_map_file(path, &size, &contents);
+    if (!mapped && !enkl_read_file(path, &size, (char**) &contents, world->allocator))
         goto fail;
 
+    if (size < sizeof(McRegionHeader)) {
+        if (mapped)
+            enkl_unmap_file(contents, size);
+        else
+            world->allocator->free_bytes(world->allocator, (void*) contents);
+        goto fail;
+    }
+
+    if (mapped) {
+        // we only ever touch a handful of chunks per region, readahead would just pull in the rest of the file
+        enkl_advise_mapping(contents, size, 0, size, Enkl_Advice_Random);
+        enkl_advise_mapping(contents, size, 0, sizeof(McRegionHeader), Enkl_Advice_WillNeed);
+    }
+
     McRegion* region = world->allocator->allocate_bytes(world->allocator, sizeof(McRegion), alignof(McRegion));
     region->world = world;
+    region->x = x;
+    region->z = z;
+    region->bytes = contents;
+    region->size = size;
+    region->mapped = mapped;
 
-    // decode the headers
-    const McRegionHeader* big_endian_header = contents;
-    for (int cz = 0; cz < 32; cz++) {
-        for (int cx = 0; cx < 32; cx++) {
-            // We need to swap the endianness of those
-            ChunkLocation location = region->decoded_header.locations[cz][cx];
-            location.offset = enkl_swap_endianness(3, big_endian_header->locations[cz][cx].offset & 0xFFFFFF);
-            location.sector_count = enkl_swap_endianness(1, big_endian_header->locations[cz][cx].sector_count & 0xFF);
-            region->decoded_header.locations[cz][cx] = location;
-            // Likewise.
-            region->decoded_header.timestamps[cz][cx] = enkl_swap_endianness(4, big_endian_header->timestamps[cz][cx]);
-
-            assert(region->decoded_header.locations[cz][cx].offset * 4096 < size);
-            McRegionPayload* payload = &region->decoded_payloads[cz][cx];
-
-            if (location.sector_count > 0) {
-                const McRegionPayload* big_endian_payload = contents + location.offset * 4096;
-                payload->length = enkl_swap_endianness(4, big_endian_payload->length);
-                // payload->compression_type = swap_endianness(4, big_endian_payload->compression_type);
-                payload->compression_type = big_endian_payload->compression_type;
-                assert((McChunkCompression) payload->compression_type <= Compr_Uncompressed);
-                payload->compressed_data = (char *) big_endian_payload + 5;
-
-                assert((size_t) (location.offset * 4096 + payload->length) <= size);
-            } else {
-                payload->length = 0;
-                payload->compressed_data = NULL;
-            }
-        }
-    }
+    // decode the headers, the payloads themselves are left alone until a chunk is opened
+    decode_region_header((const McRegionHeader*) contents, size, &region->index);
+    for (int cz = 0; cz < 32; cz++)
+        for (int cx = 0; cx < 32; cx++)
+            region->decoded_payloads[cz][cx] = (McRegionPayload) { 0 };
 
     free((char*) path);
-    region->bytes = contents;
     return region;
 
     fail:
@@ -120,60 +180,298 @@ McRegion* cunk_open_mcregion(McWorld* world, int x, int z) {
     return NULL;
 }
 
+const McRegionIndex* cunk_mcregion_get_index(const McRegion* r) { return &r->index; }
+
 void enkl_close_region(McRegion* r) {
     Enkl_Allocator* allocator = r->world->allocator;
-    allocator->free_bytes(allocator, r->bytes);
+    if (r->mapped)
+        enkl_unmap_file(r->bytes, r->size);
+    else
+        allocator->free_bytes(allocator, (void*) r->bytes);
     allocator->free_bytes(allocator, r);
 }
 
+static void advise_chunk(McRegion* region, unsigned int x, unsigned int z, Enkl_MappingAdvice advice) {
+    if (!region->mapped)
+        return;
+    const McRegionIndex* index = &region->index;
+    enkl_advise_mapping(region->bytes, region->size, (size_t) index->sector_offsets[z][x] * 4096, (size_t) index->sector_counts[z][x] * 4096, advice);
+}
+
+/// Decodes the payload header of a chunk on first use, so opening a region only faults in the location table.
+static const McRegionPayload* fetch_payload(McRegion* region, unsigned int x, unsigned int z) {
+    if (!cunk_mcregion_index_has_chunk(&region->index, x, z))
+        return NULL;
+
+    McRegionPayload* payload = &region->decoded_payloads[z][x];
+    if (!payload->compressed_data) {
+        advise_chunk(region, x, z, Enkl_Advice_WillNeed);
+        size_t offset = (size_t) region->index.sector_offsets[z][x] * 4096;
+        // a truncated file, or a corrupt length: there's no payload to be had
+        if (offset + 5 > region->size)
+            return NULL;
+        const char* big_endian_payload = region->bytes + offset;
+        uint32_t length;
+        memcpy(&length, big_endian_payload, sizeof(length));
+        length = enkl_swap_endianness(4, length);
+        if (length < 1 || offset + 4 + length > region->size)
+            return NULL;
+        // the length counts the compression type byte too
+        payload->length = length - 1;
+        payload->compression_type = big_endian_payload[4];
+        payload->compressed_data = big_endian_payload + 5;
+    }
+    return payload;
+}
+
 struct McChunk_ {
     McRegion* region;
+    /// the chunk itself and its whole tree live in there
+    Enkl_Arena* arena;
     NBT_Object* root;
 };
 
-McChunk* cunk_open_mcchunk(McRegion* region, unsigned int x, unsigned int z) {
-    assert(x < 32 && z < 32);
-    Enkl_Allocator* allocator = region->world->allocator;
+static Enkl_Arena* acquire_chunk_arena(McWorld* world) {
+    Enkl_Arena* arena = NULL;
+    mtx_lock(&world->arenas_lock);
+    if (world->spare_arenas_count > 0)
+        arena = world->spare_arenas[--world->spare_arenas_count];
+    mtx_unlock(&world->arenas_lock);
+    if (!arena)
+        arena = enkl_create_arena(world->allocator, CHUNK_ARENA_BLOCK_SIZE);
+    return arena;
+}
 
-    NBT_Object* root = NULL;
-    McRegionPayload* payload = &region->decoded_payloads[z][x];
-    if (payload->length == 0)
-        return NULL;
-    const char* nbt_data = payload->compressed_data;
-    uint32_t nbt_data_size = payload->length;
-    switch ((McChunkCompression) payload->compression_type) {
+static void release_chunk_arena(McWorld* world, Enkl_Arena* arena) {
+    enkl_reset_arena(arena);
+    mtx_lock(&world->arenas_lock);
+    if (world->spare_arenas_count < MAX_SPARE_CHUNK_ARENAS) {
+        world->spare_arenas[world->spare_arenas_count++] = arena;
+        arena = NULL;
+    }
+    mtx_unlock(&world->arenas_lock);
+    if (arena)
+        enkl_destroy_arena(arena);
+}
+
+/// Decompresses a payload into the thread's scratch arena, or, when keep is set, into memory from the allocator that outlives the call
+static bool decompress_payload(McChunkCompression compression, size_t size, const char* data, bool keep, Enkl_Allocator* allocator, size_t* decompressed_size, const void** decompressed_data) {
+    Enkl_InflateContext* ctx = enkl_get_thread_inflate_context();
+    switch (compression) {
         case Compr_Zlib:
         case Compr_GZip: {
-            ZLibMode zlib_mode = payload->compression_type == Compr_GZip ? ZLib_GZip : ZLib_Zlib;
-            assert(payload->compression_type == 2);
-            assert(zlib_mode == ZLib_Zlib);
-            void* decompressed_nbt_data;
-            size_t decompressed_size;
-            enkl_inflate(zlib_mode, (size_t) nbt_data_size, nbt_data, &decompressed_size, &decompressed_nbt_data, allocator);
-            root = cunk_decode_nbt(decompressed_size, decompressed_nbt_data, allocator);
-            free((char*) decompressed_nbt_data);
-            break;
+            ZLibMode zlib_mode = compression == Compr_GZip ? ZLib_GZip : ZLib_Zlib;
+            if (keep)
+                return enkl_inflate_with_context_into(ctx, zlib_mode, size, data, decompressed_size, (void**) decompressed_data, allocator);
+            return enkl_inflate_with_context(ctx, zlib_mode, size, data, decompressed_size, decompressed_data);
+        }
+        case Compr_LZ4: {
+            if (!enkl_lz4_block_stream_size(size, data, decompressed_size))
+                return false;
+            void* output = keep ? allocator->allocate_bytes(allocator, *decompressed_size, 1) : enkl_inflate_context_reserve_output(ctx, *decompressed_size);
+            if (!output)
+                return false;
+            *decompressed_data = output;
+            return enkl_lz4_block_stream_decode(size, data, *decompressed_size, output);
         }
         case Compr_Uncompressed: {
-            root = cunk_decode_nbt(nbt_data_size, nbt_data, allocator);
-            break;
+            *decompressed_size = size;
+            *decompressed_data = data;
+            if (keep) {
+                // the payload may be unmapped or dropped from the page cache after this, so views need their own copy
+                void* copy = allocator->allocate_bytes(allocator, size, 1);
+                memcpy(copy, data, size);
+                *decompressed_data = copy;
+            }
+            return true;
         }
+        default:
+            return false;
     }
+}
 
-    assert(root);
+static NBT_Object* decode_payload(McChunkCompression compression, size_t size, const char* data, NBT_DecodeMode mode, Enkl_Allocator* allocator) {
+    // a copied tree doesn't need the decompressed bytes afterwards, whereas views need them to live as long as the tree
+    bool keep = mode == NBT_Decode_View;
+    const void* decompressed_nbt_data;
+    size_t decompressed_size;
+    if (!decompress_payload(compression, size, data, keep, allocator, &decompressed_size, &decompressed_nbt_data))
+        return NULL;
+    return cunk_decode_nbt_with_mode(decompressed_size, decompressed_nbt_data, mode, allocator);
+}
 
-    McChunk* chunk = calloc(1, sizeof(McChunk));
+typedef struct {
+    const char* contents;
+    size_t size;
+    bool mapped;
+} ExternalPayload;
+
+static bool open_external_payload(McRegion* region, unsigned int x, unsigned int z, ExternalPayload* external) {
+    Enkl_Allocator* allocator = region->world->allocator;
+    // external chunks are named after their absolute chunk coordinates
+    const char* path = enkl_format_string("%s/region/c.%d.%d.mcc", region->world->path, region->x * 32 + (int) x, region->z * 32 + (int) z);
+
+    external->mapped = enkl_map_file(path, &external->size, &external->contents);
+    if (!external->mapped && !enkl_read_file(path, &external->size, (char**) &external->contents, allocator)) {
+        free((char*) path);
+        return false;
+    }
+    free((char*) path);
+
+    if (external->mapped)
+        enkl_advise_mapping(external->contents, external->size, 0, external->size, Enkl_Advice_WillNeed);
+    return true;
+}
+
+static void close_external_payload(McRegion* region, ExternalPayload* external) {
+    Enkl_Allocator* allocator = region->world->allocator;
+    if (external->mapped)
+        enkl_unmap_file(external->contents, external->size);
+    else
+        allocator->free_bytes(allocator, (void*) external->contents);
+}
+
+static NBT_Object* decode_external_payload(McRegion* region, unsigned int x, unsigned int z, McChunkCompression compression, NBT_DecodeMode mode, Enkl_Allocator* tree_allocator) {
+    ExternalPayload external;
+    if (!open_external_payload(region, x, z, &external))
+        return NULL;
+    NBT_Object* root = decode_payload(compression, external.size, external.contents, mode, tree_allocator);
+    close_external_payload(region, &external);
+    return root;
+}
+
+static McChunk* decode_chunk(McRegion* region, unsigned int x, unsigned int z, const McRegionPayload* payload) {
+    Enkl_Arena* arena = acquire_chunk_arena(region->world);
+    Enkl_Allocator* allocator = enkl_get_arena_allocator(arena);
+    // in view mode the decompressed bytes go in the chunk's arena too, right next to the tree pointing into them
+    NBT_DecodeMode mode = region->world->chunk_views ? NBT_Decode_View : NBT_Decode_Copy;
+
+    NBT_Object* root;
+    if (payload->compression_type & COMPR_EXTERNAL_BIT) {
+        root = decode_external_payload(region, x, z, payload->compression_type & ~COMPR_EXTERNAL_BIT, mode, allocator);
+    } else {
+        root = decode_payload(payload->compression_type, payload->length, payload->compressed_data, mode, allocator);
+        // the decoded tree doesn't reference the payload anymore, let the OS drop those pages again
+        advise_chunk(region, x, z, Enkl_Advice_DontNeed);
+    }
+    if (!root) {
+        release_chunk_arena(region->world, arena);
+        return NULL;
+    }
+
+    McChunk* chunk = allocator->allocate_bytes(allocator, sizeof(McChunk), alignof(McChunk));
     *chunk = (McChunk) {
         .region = region,
+        .arena = arena,
         .root = root,
     };
     return chunk;
 }
 
+McChunk* cunk_open_mcchunk(McRegion* region, unsigned int x, unsigned int z) {
+    assert(x < 32 && z < 32);
+    const McRegionPayload* payload = fetch_payload(region, x, z);
+    if (!payload)
+        return NULL;
+    return decode_chunk(region, x, z, payload);
+}
+
+static bool visit_payload(McChunkCompression compression, size_t size, const char* data, NBT_Visitor* visitor) {
+    const void* decompressed_nbt_data;
+    size_t decompressed_size;
+    if (!decompress_payload(compression, size, data, false, NULL, &decompressed_size, &decompressed_nbt_data))
+        return false;
+    return cunk_visit_nbt(decompressed_size, decompressed_nbt_data, visitor);
+}
+
+bool cunk_visit_mcchunk(McRegion* region, unsigned int x, unsigned int z, NBT_Visitor* visitor) {
+    assert(x < 32 && z < 32);
+    const McRegionPayload* payload = fetch_payload(region, x, z);
+    if (!payload)
+        return false;
+
+    if (payload->compression_type & COMPR_EXTERNAL_BIT) {
+        ExternalPayload external;
+        if (!open_external_payload(region, x, z, &external))
+            return false;
+        bool ok = visit_payload(payload->compression_type & ~COMPR_EXTERNAL_BIT, external.size, external.contents, visitor);
+        close_external_payload(region, &external);
+        return ok;
+    }
+
+    bool ok = visit_payload(payload->compression_type, payload->length, payload->compressed_data, visitor);
+    advise_chunk(region, x, z, Enkl_Advice_DontNeed);
+    return ok;
+}
+
+typedef struct {
+    uint32_t sector_offset;
+    size_t i;
+} BatchEntry;
+
+static int compare_batch_entries(const void* a, const void* b) {
+    uint32_t offset_a = ((const BatchEntry*) a)->sector_offset;
+    uint32_t offset_b = ((const BatchEntry*) b)->sector_offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+typedef struct {
+    McRegion* region;
+    const McChunkPosition* positions;
+    McChunk** out_chunks;
+    const BatchEntry* entries;
+} BatchOpen;
+
+static void batch_decode_task(BatchOpen* batch, size_t n) {
+    size_t i = batch->entries[n].i;
+    McChunkPosition position = batch->positions[i];
+    const McRegionPayload* payload = &batch->region->decoded_payloads[position.z][position.x];
+    batch->out_chunks[i] = decode_chunk(batch->region, position.x, position.z, payload);
+}
+
+void cunk_open_mcchunks(McRegion* region, size_t count, const McChunkPosition* positions, McChunk** out_chunks, Enkl_ThreadPool* pool) {
+    Enkl_Allocator* allocator = region->world->allocator;
+    BatchEntry* entries = allocator->allocate_bytes(allocator, sizeof(BatchEntry) * count, alignof(BatchEntry));
+
+    size_t present = 0;
+    for (size_t i = 0; i < count; i++) {
+        McChunkPosition position = positions[i];
+        assert(position.x < 32 && position.z < 32);
+        out_chunks[i] = NULL;
+        if (cunk_mcregion_index_has_chunk(&region->index, position.x, position.z))
+            entries[present++] = (BatchEntry) { region->index.sector_offsets[position.z][position.x], i };
+    }
+    qsort(entries, present, sizeof(BatchEntry), compare_batch_entries);
+
+    // only the 5 byte payload headers are read here, in file order, along with a readahead hint for each chunk's sectors:
+    // the payloads themselves are paged in by whichever task decodes them, in any order
+    size_t fetched = 0;
+    for (size_t n = 0; n < present; n++) {
+        McChunkPosition position = positions[entries[n].i];
+        if (fetch_payload(region, position.x, position.z))
+            entries[fetched++] = entries[n];
+    }
+    present = fetched;
+
+    BatchOpen batch = {
+        .region = region,
+        .positions = positions,
+        .out_chunks = out_chunks,
+        .entries = entries,
+    };
+    if (pool) {
+        pool->parallel_for(pool, present, (void (*)(void*, size_t)) batch_decode_task, &batch);
+    } else {
+        for (size_t n = 0; n < present; n++)
+            batch_decode_task(&batch, n);
+    }
+
+    allocator->free_bytes(allocator, entries);
+}
+
 void enkl_close_chunk(McChunk* chunk) {
-    Enkl_Allocator* allocator = chunk->region->world->allocator;
-    enkl_free_nbt(chunk->root, allocator);
-    free(chunk);
+    // no need to walk the tree, dropping the arena takes the chunk and everything in it
+    release_chunk_arena(chunk->region->world, chunk->arena);
 }
 
 const NBT_Object* cunk_mcchunk_get_root(const McChunk* c) { return c->root; }
@@ -1,20 +1,1129 @@
 #include "enklume/enklume.h"
 #include "enklume/nbt.h"
+#include "enklume/block_data.h"
 #include "support_private.h"
+#include "section_pool.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 #include <limits.h>
+#include <threads.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t next_random(uint64_t* state) {
+    // splitmix64
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/// Index i of a section's block states, read one bit at a time
+static unsigned reference_index(const uint64_t* longs, unsigned bits, bool can_straddle, size_t i) {
+    size_t bit = i * bits;
+    if (!can_straddle) {
+        unsigned per_long = 64 / bits;
+        bit = (i / per_long) * 64 + (i % per_long) * bits;
+    }
+    unsigned value = 0;
+    for (unsigned b = 0; b < bits; b++, bit++)
+        value |= (unsigned) (longs[bit / 64] >> (bit % 64) & 1) << b;
+    return value;
+}
+
+static void check_unpack(void) {
+    uint64_t seed = 1;
+    for (unsigned bits = 1; bits <= 16; bits++) {
+        for (int can_straddle = 0; can_straddle < 2; can_straddle++) {
+            size_t count = can_straddle ? (4096 * bits + 63) / 64 : (4096 + 64 / bits - 1) / (64 / bits);
+            // exactly as many longs as the section needs, so reading past them shows up under ASan
+            uint64_t* longs = malloc(count * sizeof(uint64_t));
+            for (size_t l = 0; l < count; l++)
+                longs[l] = next_random(&seed);
+
+            uint16_t indices[4096], scalar_indices[4096];
+            bool short_ok = enkl_unpack_section_indices(longs, count - 1, bits, can_straddle, indices);
+            bool ok = enkl_unpack_section_indices(longs, count, bits, can_straddle, indices);
+            bool scalar_ok = enkl_unpack_section_indices_scalar(longs, count, bits, can_straddle, scalar_indices);
+            assert(!short_ok && ok && scalar_ok);
+            for (size_t i = 0; i < 4096; i++) {
+                unsigned expected = reference_index(longs, bits, can_straddle, i);
+                if (indices[i] != expected || scalar_indices[i] != expected) {
+                    fprintf(stderr, "unpacking %u bits (straddling: %d) gets index %zu wrong\n", bits, can_straddle, i);
+                    abort();
+                }
+            }
+            free(longs);
+        }
+    }
+    printf("unpack: ok\n");
+}
+
+#define LZ4_BLOCK_HEADER(method, compressed, original, checksum) \
+    'L', 'Z', '4', 'B', 'l', 'o', 'c', 'k', method, \
+    (compressed) & 0xFF, (compressed) >> 8 & 0xFF, 0, 0, \
+    (original) & 0xFF, (original) >> 8 & 0xFF, 0, 0, \
+    (checksum) & 0xFF, (checksum) >> 8 & 0xFF, (checksum) >> 16 & 0xFF, (checksum) >> 24 & 0xFF
+
+static void check_lz4_blocks(void) {
+    // checksums are the xxh32 of each block with lz4-java's seed, minus the top 4 bits: 0x4b570a48 and 0x637329fa in full
+    const uint8_t stream[] = {
+        LZ4_BLOCK_HEADER(0x10, 20, 20, 0x0b570a48u),
+        'h', 'e', 'l', 'l', 'o', ',', ' ', 'r', 'e', 'g', 'i', 'o', 'n', ' ', 'f', 'i', 'l', 'e', 's', '!',
+        // "abc", then a 25 byte match overlapping it, then "bcabc": "abc" 11 times over
+        LZ4_BLOCK_HEADER(0x20, 13, 33, 0x037329fau),
+        0x3F, 'a', 'b', 'c', 0x03, 0x00, 0x06, 0x50, 'b', 'c', 'a', 'b', 'c',
+        LZ4_BLOCK_HEADER(0x10, 0, 0, 0),
+    };
+    const char* expected = "hello, region files!abcabcabcabcabcabcabcabcabcabcabc";
+
+    size_t size;
+    bool size_ok = enkl_lz4_block_stream_size(sizeof(stream), stream, &size);
+    assert(size_ok && size == strlen(expected));
+    char decoded[64];
+    bool decode_ok = enkl_lz4_block_stream_decode(sizeof(stream), stream, size, decoded);
+    assert(decode_ok && memcmp(decoded, expected, size) == 0);
+
+    // the full hash doesn't match what lz4-java writes
+    uint8_t unmasked[sizeof(stream)];
+    memcpy(unmasked, stream, sizeof(stream));
+    unmasked[20] |= 0x40;
+    assert(!enkl_lz4_block_stream_decode(sizeof(unmasked), unmasked, size, decoded));
+
+    uint8_t corrupted[sizeof(stream)];
+    memcpy(corrupted, stream, sizeof(stream));
+    corrupted[21 + 20 + 21 + 1] = 'x';
+    assert(!enkl_lz4_block_stream_decode(sizeof(corrupted), corrupted, size, decoded));
+
+    // a match reaching back before the start of the block
+    memcpy(corrupted, stream, sizeof(stream));
+    corrupted[21 + 20 + 21 + 4] = 0x04;
+    assert(!enkl_lz4_block_stream_decode(sizeof(corrupted), corrupted, size, decoded));
+
+    // cut off in the middle of the second block
+    size_t truncated = 21 + 20 + 21 + 5;
+    assert(!enkl_lz4_block_stream_size(truncated, stream, &size));
+    assert(!enkl_lz4_block_stream_decode(truncated, stream, strlen(expected), decoded));
+    printf("lz4: ok\n");
+}
+
+static uint32_t test_crc32(const uint8_t* bytes, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc >> 1 ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+/// Remembers the first allocation, which is what the inflater reserved up front
+typedef struct {
+    Enkl_Allocator allocator;
+    Enkl_Allocator backing;
+    size_t reserved;
+} ReserveSpy;
+
+static void* spy_allocate(Enkl_Allocator* a, size_t size, size_t alignment) {
+    ReserveSpy* spy = (ReserveSpy*) a;
+    if (spy->reserved == 0)
+        spy->reserved = size;
+    return spy->backing.allocate_bytes(&spy->backing, size, alignment);
+}
+
+static void* spy_grow(Enkl_Allocator* a, void* old, size_t alignment, size_t old_size, size_t new_size) {
+    ReserveSpy* spy = (ReserveSpy*) a;
+    return spy->backing.grow_allocation(&spy->backing, old, alignment, old_size, new_size);
+}
+
+static void spy_free(Enkl_Allocator* a, void* ptr) {
+    ReserveSpy* spy = (ReserveSpy*) a;
+    spy->backing.free_bytes(&spy->backing, ptr);
+}
+
+#define GZIP_TEST_DATA_SIZE 64
+
+static void check_gzip_size_hint(void) {
+    // a single stored deflate block, then the crc and size trailer
+    uint8_t stream[10 + 5 + GZIP_TEST_DATA_SIZE + 8] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff, 1, GZIP_TEST_DATA_SIZE, 0, ~GZIP_TEST_DATA_SIZE & 0xFF, 0xFF };
+    uint8_t* data = stream + 15;
+    for (int i = 0; i < GZIP_TEST_DATA_SIZE; i++)
+        data[i] = (uint8_t) (i * 7);
+    uint32_t trailer[2] = { test_crc32(data, GZIP_TEST_DATA_SIZE), GZIP_TEST_DATA_SIZE };
+    for (int i = 0; i < 8; i++)
+        stream[sizeof(stream) - 8 + i] = (uint8_t) (trailer[i / 4] >> (i % 4 * 8));
+
+    ReserveSpy spy = { .allocator = { spy_allocate, spy_grow, spy_free }, .backing = enkl_get_malloc_free_allocator() };
+    size_t size;
+    void* output;
+    bool ok = enkl_inflate(ZLib_GZip, sizeof(stream), stream, &size, &output, &spy.allocator);
+    assert(ok && size == GZIP_TEST_DATA_SIZE && memcmp(output, data, size) == 0);
+    assert(spy.reserved == GZIP_TEST_DATA_SIZE);
+    spy.backing.free_bytes(&spy.backing, output);
+
+    // a size no deflate stream this short could inflate to isn't reserved up front, the stream then fails its length check
+    stream[sizeof(stream) - 1] = 0xF0;
+    spy.reserved = 0;
+    ok = enkl_inflate(ZLib_GZip, sizeof(stream), stream, &size, &output, &spy.allocator);
+    assert(!ok && spy.reserved <= 4096);
+    printf("gzip size hint: ok\n");
+}
+
+typedef struct {
+    uint8_t bytes[64 * 1024];
+    size_t size;
+} TestBuffer;
+
+static void put_be(TestBuffer* b, uint64_t value, int bytes) {
+    assert(b->size + bytes <= sizeof(b->bytes));
+    for (int i = bytes - 1; i >= 0; i--)
+        b->bytes[b->size++] = (uint8_t) (value >> (i * 8));
+}
+
+static void put_string(TestBuffer* b, const char* s) {
+    put_be(b, strlen(s), 2);
+    memcpy(b->bytes + b->size, s, strlen(s));
+    b->size += strlen(s);
+}
+
+static void put_named(TestBuffer* b, NBT_Tag tag, const char* name) {
+    put_be(b, tag, 1);
+    put_string(b, name);
+}
+
+/// Stone in section 0, dirt in a third of section 1, air everywhere else
+static BlockData test_chunk_block(unsigned x, unsigned y, unsigned z) {
+    int section = (int) (y / 16) + CUNK_CHUNK_MIN_SECTION;
+    unsigned i = (y % 16) * 256 + z * 16 + x;
+    if (section == 0)
+        return BlockStone;
+    if (section == 1 && i % 3 == 0)
+        return BlockDirt;
+    return BlockAir;
+}
+
+/// A 1.18 chunk with the blocks of test_chunk_block
+static void write_test_chunk(TestBuffer* b) {
+    put_named(b, NBT_Tag_Compound, "");
+    put_named(b, NBT_Tag_Int, "DataVersion");
+    put_be(b, 3120, 4);
+    put_named(b, NBT_Tag_List, "sections");
+    put_be(b, NBT_Tag_Compound, 1);
+    put_be(b, 2, 4);
+
+    put_named(b, NBT_Tag_Byte, "Y");
+    put_be(b, 0, 1);
+    put_named(b, NBT_Tag_Compound, "block_states");
+    put_named(b, NBT_Tag_List, "palette");
+    put_be(b, NBT_Tag_Compound, 1);
+    put_be(b, 1, 4);
+    put_named(b, NBT_Tag_String, "Name");
+    put_string(b, "minecraft:stone");
+    put_be(b, NBT_Tag_End, 1);
+    put_be(b, NBT_Tag_End, 1);
+    put_be(b, NBT_Tag_End, 1);
+
+    put_named(b, NBT_Tag_Byte, "Y");
+    put_be(b, 1, 1);
+    put_named(b, NBT_Tag_Compound, "block_states");
+    put_named(b, NBT_Tag_List, "palette");
+    put_be(b, NBT_Tag_Compound, 1);
+    put_be(b, 2, 4);
+    put_named(b, NBT_Tag_String, "Name");
+    put_string(b, "minecraft:air");
+    put_be(b, NBT_Tag_End, 1);
+    put_named(b, NBT_Tag_String, "Name");
+    put_string(b, "minecraft:dirt");
+    put_be(b, NBT_Tag_End, 1);
+    // 4 bits per block at least, 16 blocks to a long
+    put_named(b, NBT_Tag_LongArray, "data");
+    put_be(b, 256, 4);
+    for (unsigned l = 0; l < 256; l++) {
+        uint64_t word = 0;
+        for (unsigned j = 0; j < 16; j++)
+            word |= (uint64_t) ((l * 16 + j) % 3 == 0) << (j * 4);
+        put_be(b, word, 8);
+    }
+    put_be(b, NBT_Tag_End, 1);
+    put_be(b, NBT_Tag_End, 1);
+
+    put_be(b, NBT_Tag_End, 1);
+}
+
+static void write_test_file(const char* path, const void* bytes, size_t size) {
+    FILE* f = fopen(path, "wb");
+    assert(f);
+    size_t written = fwrite(bytes, 1, size, f);
+    assert(written == size);
+    fclose(f);
+}
+
+static void check_test_chunk(const ChunkData* chunk) {
+    for (unsigned y = 0; y < CUNK_CHUNK_MAX_HEIGHT; y++)
+        for (unsigned z = 0; z < 16; z++)
+            for (unsigned x = 0; x < 16; x++)
+                assert(chunk_get_block_data(chunk, x, y, z) == test_chunk_block(x, y, z));
+}
+
+/// A world folder in /tmp, with an empty level.dat and a region folder for the test to fill (and clean up)
+typedef struct {
+    char folder[32];
+    char* region_folder;
+} TestWorld;
+
+static void create_test_world(TestWorld* w) {
+    strcpy(w->folder, "/tmp/enklume_test_XXXXXX");
+    bool made = mkdtemp(w->folder) != NULL;
+    assert(made);
+    w->region_folder = enkl_format_string("%s/region", w->folder);
+    mkdir(w->region_folder, 0755);
+    char* level_path = enkl_format_string("%s/level.dat", w->folder);
+    write_test_file(level_path, "", 0);
+    free(level_path);
+}
+
+static void destroy_test_world(TestWorld* w) {
+    char* level_path = enkl_format_string("%s/level.dat", w->folder);
+    remove(level_path);
+    free(level_path);
+    rmdir(w->region_folder);
+    rmdir(w->folder);
+    free(w->region_folder);
+}
+
+static void set_test_location(uint8_t* region_bytes, unsigned x, unsigned z, unsigned sector, unsigned sectors_count) {
+    uint8_t* location = region_bytes + (z * 32 + x) * 4;
+    location[0] = (uint8_t) (sector >> 16);
+    location[1] = (uint8_t) (sector >> 8);
+    location[2] = (uint8_t) sector;
+    location[3] = (uint8_t) sectors_count;
+}
+
+/// Oversized chunks have a placeholder payload in the region, flagged with 0x80, and the data in region/c.X.Z.mcc
+static void check_external_chunks(void) {
+    TestWorld test_world;
+    create_test_world(&test_world);
+    const char* folder = test_world.folder;
+    const char* region_folder = test_world.region_folder;
+
+    TestBuffer nbt = { 0 };
+    write_test_chunk(&nbt);
+    char* external_path = enkl_format_string("%s/c.1.2.mcc", region_folder);
+    write_test_file(external_path, nbt.bytes, nbt.size);
+
+    // chunk (0, 0) stored uncompressed in the region, (1, 2) external, (3, 2) external as well but its .mcc is missing
+    static uint8_t region_bytes[4 * 4096];
+    memset(region_bytes, 0, sizeof(region_bytes));
+    set_test_location(region_bytes, 0, 0, 2, 1);
+    set_test_location(region_bytes, 1, 2, 3, 1);
+    set_test_location(region_bytes, 3, 2, 3, 1);
+    TestBuffer inline_payload = { .size = 0 };
+    put_be(&inline_payload, nbt.size + 1, 4);
+    put_be(&inline_payload, 3, 1);
+    memcpy(region_bytes + 2 * 4096, inline_payload.bytes, inline_payload.size);
+    memcpy(region_bytes + 2 * 4096 + inline_payload.size, nbt.bytes, nbt.size);
+    // the length only covers the compression type
+    const uint8_t external_payload[] = { 0, 0, 0, 1, 0x80 | 3 };
+    memcpy(region_bytes + 3 * 4096, external_payload, sizeof(external_payload));
+    char* region_path = enkl_format_string("%s/r.0.0.mca", region_folder);
+    write_test_file(region_path, region_bytes, sizeof(region_bytes));
+
+    Enkl_Allocator allocator = enkl_get_malloc_free_allocator();
+    McWorld* world = cunk_open_mcworld(folder, &allocator);
+    assert(world);
+    McRegion* region = cunk_open_mcregion(world, 0, 0);
+    assert(region);
+
+    ChunkData streamed = { 0 }, streamed_external = { 0 }, missing = { 0 };
+    bool streamed_ok = load_from_mcregion(&streamed, region, 0, 0);
+    bool streamed_external_ok = load_from_mcregion(&streamed_external, region, 1, 2);
+    assert(streamed_ok && streamed_external_ok);
+    check_test_chunk(&streamed);
+    check_test_chunk(&streamed_external);
+    assert(!load_from_mcregion(&missing, region, 3, 2));
+
+    // trees, copied and then pointing into the decompressed data
+    for (int views = 0; views < 2; views++) {
+        cunk_mcworld_set_chunk_views(world, views);
+        McChunk* external = cunk_open_mcchunk(region, 1, 2);
+        assert(external && cunk_mcchunk_get_data_version(external) == 3120);
+        ChunkData decoded = { 0 };
+        load_from_mcchunk(&decoded, external);
+        enkl_close_chunk(external);
+        check_test_chunk(&decoded);
+        enkl_destroy_chunk_data(&decoded);
+        assert(!cunk_open_mcchunk(region, 3, 2));
+    }
+
+    McChunkPosition positions[] = { { 3, 2 }, { 1, 2 }, { 0, 0 }, { 5, 5 } };
+    McChunk* batch[4];
+    cunk_open_mcchunks(region, 4, positions, batch, NULL);
+    assert(!batch[0] && batch[1] && batch[2] && !batch[3]);
+    for (int i = 1; i < 3; i++) {
+        ChunkData decoded = { 0 };
+        load_from_mcchunk(&decoded, batch[i]);
+        enkl_close_chunk(batch[i]);
+        check_test_chunk(&decoded);
+        enkl_destroy_chunk_data(&decoded);
+    }
+
+    enkl_destroy_chunk_data(&streamed);
+    enkl_destroy_chunk_data(&streamed_external);
+    enkl_destroy_chunk_data(&missing);
+    enkl_close_region(region);
+    cunk_close_mcworld(world);
+
+    remove(region_path);
+    remove(external_path);
+    free(region_path);
+    free(external_path);
+    destroy_test_world(&test_world);
+    printf("external chunks: ok\n");
+}
+
+/// Region files that end in the middle of a sector (as they did before 1.14), and headers pointing at what isn't there
+static void check_region_bounds(void) {
+    TestWorld test_world;
+    create_test_world(&test_world);
+
+    TestBuffer nbt = { 0 };
+    write_test_chunk(&nbt);
+    static uint8_t region_bytes[4 * 4096];
+    memset(region_bytes, 0, sizeof(region_bytes));
+    // a payload running past the end of the file in sector 2, then a good one ending the file right after its last byte
+    const uint8_t overlong_payload[] = { 0, 1, 0, 0, 3 };
+    memcpy(region_bytes + 2 * 4096, overlong_payload, sizeof(overlong_payload));
+    TestBuffer payload = { .size = 0 };
+    put_be(&payload, nbt.size + 1, 4);
+    put_be(&payload, 3, 1);
+    memcpy(region_bytes + 3 * 4096, payload.bytes, payload.size);
+    memcpy(region_bytes + 3 * 4096 + payload.size, nbt.bytes, nbt.size);
+    size_t file_size = 3 * 4096 + payload.size + nbt.size;
+
+    set_test_location(region_bytes, 0, 0, 3, 1);
+    // in the header
+    set_test_location(region_bytes, 1, 0, 1, 1);
+    set_test_location(region_bytes, 2, 0, 0, 1);
+    // past the end of the file
+    set_test_location(region_bytes, 3, 0, 9, 1);
+    // more sectors than the file has left, which is fine since the payload length says where it ends
+    set_test_location(region_bytes, 4, 0, 3, 5);
+    set_test_location(region_bytes, 5, 0, 2, 1);
+    char* region_path = enkl_format_string("%s/r.0.0.mca", test_world.region_folder);
+    write_test_file(region_path, region_bytes, file_size);
+
+    Enkl_Allocator allocator = enkl_get_malloc_free_allocator();
+    McWorld* world = cunk_open_mcworld(test_world.folder, &allocator);
+    assert(world);
+    McRegionIndex scanned;
+    bool scanned_ok = cunk_scan_mcregion_index(world, 0, 0, &scanned);
+    assert(scanned_ok);
+    McRegion* region = cunk_open_mcregion(world, 0, 0);
+    assert(region);
+    const uint32_t present = 1u << 0 | 1u << 4 | 1u << 5;
+    assert(scanned.present[0] == present && cunk_mcregion_get_index(region)->present[0] == present);
+
+    for (unsigned x = 0; x < 6; x++) {
+        bool loads = x == 0 || x == 4;
+        ChunkData streamed = { 0 };
+        assert(load_from_mcregion(&streamed, region, x, 0) == loads);
+        McChunk* chunk = cunk_open_mcchunk(region, x, 0);
+        assert((chunk != NULL) == loads);
+        if (loads) {
+            check_test_chunk(&streamed);
+            enkl_close_chunk(chunk);
+        }
+        enkl_destroy_chunk_data(&streamed);
+    }
+
+    McChunkPosition positions[] = { { 5, 0 }, { 0, 0 }, { 3, 0 }, { 4, 0 } };
+    McChunk* batch[4];
+    cunk_open_mcchunks(region, 4, positions, batch, NULL);
+    assert(!batch[0] && batch[1] && !batch[2] && batch[3]);
+    enkl_close_chunk(batch[1]);
+    enkl_close_chunk(batch[3]);
+
+    enkl_close_region(region);
+    cunk_close_mcworld(world);
+    remove(region_path);
+    free(region_path);
+    destroy_test_world(&test_world);
+    printf("region bounds: ok\n");
+}
+
+typedef enum {
+    TestFormat_PreFlattening,
+    TestFormat_Straddling,
+    TestFormat_Packed,
+    TestFormat_Sections,
+} TestFormat;
+
+/// Each format at the first and the last DataVersion it was written with (or 1.12.2 and 1.19.2 for the open ended ones):
+/// the 1.18 snapshots up to 2825 still wrote 1.17 chunks
+static const struct { TestFormat format; McDataVersion version; } test_chunk_formats[] = {
+    { TestFormat_PreFlattening, 1343 }, { TestFormat_PreFlattening, 1450 },
+    { TestFormat_Straddling, 1451 }, { TestFormat_Straddling, 2503 },
+    { TestFormat_Packed, 2504 }, { TestFormat_Packed, 2825 },
+    { TestFormat_Sections, 2826 }, { TestFormat_Sections, 3120 },
+};
+#define TEST_CHUNK_FORMATS_COUNT (sizeof(test_chunk_formats) / sizeof(test_chunk_formats[0]))
+
+static const struct { uint8_t id; BlockData block; } test_legacy_blocks[] = {
+    { 0, BlockAir }, { 1, BlockStone }, { 3, BlockDirt }, { 12, BlockSand }, { 13, BlockGravel }, { 17, BlockWood }, { 24, BlockSandStone }, { 155, BlockQuartz },
+};
+
+/// Palettes longer than this get names the registry doesn't know, which come out as BlockUnknown
+static const struct { const char* name; BlockData block; } test_flattened_blocks[] = {
+    { "minecraft:air", BlockAir }, { "minecraft:stone", BlockStone }, { "minecraft:dirt", BlockDirt }, { "minecraft:grass", BlockGrass },
+    { "minecraft:cobblestone", BlockCobbleStone }, { "minecraft:planks", BlockPlanks }, { "minecraft:water", BlockWater }, { "minecraft:lava", BlockLava },
+    { "minecraft:sand", BlockSand }, { "minecraft:gravel", BlockGravel }, { "minecraft:log", BlockWood }, { "minecraft:leaves", BlockLeaves },
+    { "minecraft:sandstone", BlockSandStone }, { "minecraft:snow", BlockSnow }, { "minecraft:white_terracotta", BlockWhiteTerracotta }, { "minecraft:quartz_block", BlockQuartz },
+};
+#define TEST_FLATTENED_BLOCKS_COUNT (sizeof(test_flattened_blocks) / sizeof(test_flattened_blocks[0]))
+
+/// What the loaders should make of the chunks written by write_format_chunk, indexed like chunk_get_block_data
+static BlockData expected_blocks[CUNK_CHUNK_MAX_HEIGHT][16][16];
+
+static void put_block_states(TestBuffer* b, const char* name, const uint16_t* indices, unsigned bits, bool can_straddle) {
+    static uint64_t words[CUNK_SECTION_BLOCKS_COUNT];
+    size_t per_word = 64 / bits;
+    size_t count = can_straddle ? (CUNK_SECTION_BLOCKS_COUNT * bits + 63) / 64 : (CUNK_SECTION_BLOCKS_COUNT + per_word - 1) / per_word;
+    memset(words, 0, sizeof(words));
+    for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+        size_t bit = can_straddle ? i * bits : i / per_word * 64 + i % per_word * bits;
+        words[bit / 64] |= (uint64_t) indices[i] << (bit % 64);
+        if (bit % 64 + bits > 64)
+            words[bit / 64 + 1] |= (uint64_t) indices[i] >> (64 - bit % 64);
+    }
+    put_named(b, NBT_Tag_LongArray, name);
+    put_be(b, count, 4);
+    for (size_t l = 0; l < count; l++)
+        put_be(b, words[l], 8);
+}
+
+/// A section of random blocks out of a palette of that many names, some with properties the loaders have to skip over
+static void put_paletted_section(TestBuffer* b, TestFormat format, int y, size_t palette_size, uint64_t* seed) {
+    bool modern = format == TestFormat_Sections;
+    put_named(b, NBT_Tag_Byte, "Y");
+    put_be(b, (uint8_t) y, 1);
+    if (modern) {
+        // biomes have a palette too, of plain strings
+        put_named(b, NBT_Tag_Compound, "biomes");
+        put_named(b, NBT_Tag_List, "palette");
+        put_be(b, NBT_Tag_String, 1);
+        put_be(b, 1, 4);
+        put_string(b, "minecraft:plains");
+        put_be(b, NBT_Tag_End, 1);
+        put_named(b, NBT_Tag_Compound, "block_states");
+    }
+
+    BlockData palette[256];
+    put_named(b, NBT_Tag_List, modern ? "palette" : "Palette");
+    put_be(b, NBT_Tag_Compound, 1);
+    put_be(b, palette_size, 4);
+    for (size_t j = 0; j < palette_size; j++) {
+        char unknown_name[32];
+        const char* name = unknown_name;
+        // starting from stone, so palettes of one aren't just air
+        if (j < TEST_FLATTENED_BLOCKS_COUNT) {
+            name = test_flattened_blocks[(j + 1) % TEST_FLATTENED_BLOCKS_COUNT].name;
+            palette[j] = test_flattened_blocks[(j + 1) % TEST_FLATTENED_BLOCKS_COUNT].block;
+        } else {
+            snprintf(unknown_name, sizeof(unknown_name), "minecraft:unknown_%zu", j);
+            palette[j] = BlockUnknown;
+        }
+        if (j % 3 == 1) {
+            put_named(b, NBT_Tag_Compound, "Properties");
+            put_named(b, NBT_Tag_String, "Name");
+            put_string(b, "not the block's name");
+            put_be(b, NBT_Tag_End, 1);
+        }
+        put_named(b, NBT_Tag_String, "Name");
+        put_string(b, name);
+        put_be(b, NBT_Tag_End, 1);
+    }
+
+    uint16_t indices[CUNK_SECTION_BLOCKS_COUNT];
+    for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+        indices[i] = (uint16_t) (next_random(seed) % palette_size);
+        int section = y - CUNK_CHUNK_MIN_SECTION;
+        if (section >= 0 && section < CUNK_CHUNK_SECTIONS_COUNT)
+            expected_blocks[section * 16 + i / 256][i / 16 % 16][i % 16] = palette[indices[i]];
+    }
+    // 1.18+ leaves the indices out when there is only one block
+    if (!modern || palette_size > 1) {
+        unsigned bits = enkl_needed_bits((unsigned) palette_size) < 4 ? 4 : enkl_needed_bits((unsigned) palette_size);
+        put_block_states(b, modern ? "data" : "BlockStates", indices, bits, format == TestFormat_Straddling);
+    }
+    if (modern)
+        put_be(b, NBT_Tag_End, 1);
+}
+
+static void put_pre_flattening_section(TestBuffer* b, int y, bool with_meta, uint64_t* seed) {
+    put_named(b, NBT_Tag_Byte, "Y");
+    put_be(b, (uint8_t) y, 1);
+    put_named(b, NBT_Tag_ByteArray, "Blocks");
+    put_be(b, CUNK_SECTION_BLOCKS_COUNT, 4);
+    for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+        size_t block = next_random(seed) % (sizeof(test_legacy_blocks) / sizeof(test_legacy_blocks[0]));
+        put_be(b, test_legacy_blocks[block].id, 1);
+        expected_blocks[(y - CUNK_CHUNK_MIN_SECTION) * 16 + i / 256][i / 16 % 16][i % 16] = test_legacy_blocks[block].block;
+    }
+    if (with_meta) {
+        put_named(b, NBT_Tag_ByteArray, "Data");
+        put_be(b, CUNK_SECTION_BLOCKS_COUNT / 2, 4);
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT / 2; i++)
+            put_be(b, next_random(seed), 1);
+    }
+    put_named(b, NBT_Tag_ByteArray, "SkyLight");
+    put_be(b, 4, 4);
+    put_be(b, 0xFFFFFFFF, 4);
+}
+
+/// A chunk in the given format with sections of every kind it can have, and fills expected_blocks with what it holds
+static void write_format_chunk(TestBuffer* b, TestFormat format, McDataVersion version, uint64_t* seed) {
+    memset(expected_blocks, 0, sizeof(expected_blocks));
+    put_named(b, NBT_Tag_Compound, "");
+    // the stream loader has to hold on to the sections until it knows the version
+    bool version_last = format == TestFormat_Packed;
+    if (!version_last) {
+        put_named(b, NBT_Tag_Int, "DataVersion");
+        put_be(b, version, 4);
+    }
+    if (format != TestFormat_Sections) {
+        put_named(b, NBT_Tag_Compound, "Level");
+        put_named(b, NBT_Tag_Int, "xPos");
+        put_be(b, 0, 4);
+    } else {
+        put_named(b, NBT_Tag_String, "Status");
+        put_string(b, "full");
+    }
+    put_named(b, NBT_Tag_List, format == TestFormat_Sections ? "sections" : "Sections");
+    put_be(b, NBT_Tag_Compound, 1);
+    if (format == TestFormat_PreFlattening) {
+        put_be(b, 3, 4);
+        put_pre_flattening_section(b, 0, true, seed);
+        put_be(b, NBT_Tag_End, 1);
+        put_pre_flattening_section(b, 5, false, seed);
+        put_be(b, NBT_Tag_End, 1);
+        put_pre_flattening_section(b, 15, true, seed);
+        put_be(b, NBT_Tag_End, 1);
+    } else {
+        // a lighting only section below the world, one block without indices, then 4 bits per block at least, 5 (which straddle words in 1.13 - 1.15), 6 and 8
+        const int ys[] = { -5, -4, 0, 2, 7, 19 };
+        const size_t palette_sizes[] = { 3, 1, 2, 17, 40, 200 };
+        int first = format == TestFormat_Sections ? 0 : 2;
+        put_be(b, 6 - first, 4);
+        for (int i = first; i < 6; i++) {
+            // sections 0 to 15 in the older formats
+            int y = format == TestFormat_Sections ? ys[i] : ys[i] % 16;
+            put_paletted_section(b, format, y, palette_sizes[i], seed);
+            put_be(b, NBT_Tag_End, 1);
+        }
+    }
+    if (format != TestFormat_Sections)
+        put_be(b, NBT_Tag_End, 1);
+    put_named(b, NBT_Tag_Compound, "Heightmaps");
+    put_named(b, NBT_Tag_LongArray, "MOTION_BLOCKING");
+    put_be(b, 1, 4);
+    put_be(b, 0, 8);
+    put_be(b, NBT_Tag_End, 1);
+    if (version_last) {
+        put_named(b, NBT_Tag_Int, "DataVersion");
+        put_be(b, version, 4);
+    }
+    put_be(b, NBT_Tag_End, 1);
+}
+
+#define FORMAT_CHUNK_SECTORS 8
+
+/// Every format, loaded through the NBT tree and streamed, comes out the same down to the last block and the same as what was written
+static void check_stream_loader(void) {
+    TestWorld test_world;
+    create_test_world(&test_world);
+
+    static uint8_t region_bytes[(2 + TEST_CHUNK_FORMATS_COUNT * FORMAT_CHUNK_SECTORS) * 4096];
+    static BlockData format_expected[TEST_CHUNK_FORMATS_COUNT][CUNK_CHUNK_MAX_HEIGHT][16][16];
+    memset(region_bytes, 0, sizeof(region_bytes));
+    uint64_t seed = 3;
+    for (unsigned n = 0; n < TEST_CHUNK_FORMATS_COUNT; n++) {
+        static TestBuffer nbt;
+        nbt.size = 0;
+        write_format_chunk(&nbt, test_chunk_formats[n].format, test_chunk_formats[n].version, &seed);
+        memcpy(format_expected[n], expected_blocks, sizeof(expected_blocks));
+        unsigned sector = 2 + n * FORMAT_CHUNK_SECTORS;
+        assert(nbt.size + 5 <= FORMAT_CHUNK_SECTORS * 4096);
+        set_test_location(region_bytes, n, 0, sector, FORMAT_CHUNK_SECTORS);
+        TestBuffer payload = { .size = 0 };
+        put_be(&payload, nbt.size + 1, 4);
+        put_be(&payload, 3, 1);
+        memcpy(region_bytes + sector * 4096, payload.bytes, payload.size);
+        memcpy(region_bytes + sector * 4096 + payload.size, nbt.bytes, nbt.size);
+    }
+    char* region_path = enkl_format_string("%s/r.0.0.mca", test_world.region_folder);
+    write_test_file(region_path, region_bytes, sizeof(region_bytes));
+
+    Enkl_Allocator allocator = enkl_get_malloc_free_allocator();
+    McWorld* world = cunk_open_mcworld(test_world.folder, &allocator);
+    assert(world);
+    McRegion* region = cunk_open_mcregion(world, 0, 0);
+    assert(region);
+    for (unsigned n = 0; n < TEST_CHUNK_FORMATS_COUNT; n++) {
+        ChunkData streamed = { 0 }, tree = { 0 };
+        bool streamed_ok = load_from_mcregion(&streamed, region, n, 0);
+        assert(streamed_ok);
+        McChunk* chunk = cunk_open_mcchunk(region, n, 0);
+        assert(chunk && cunk_mcchunk_get_data_version(chunk) == test_chunk_formats[n].version);
+        load_from_mcchunk(&tree, chunk);
+        enkl_close_chunk(chunk);
+
+        for (unsigned y = 0; y < CUNK_CHUNK_MAX_HEIGHT; y++)
+            for (unsigned z = 0; z < 16; z++)
+                for (unsigned x = 0; x < 16; x++) {
+                    BlockData expected = format_expected[n][y][z][x];
+                    if (chunk_get_block_data(&streamed, x, y, z) != expected || chunk_get_block_data(&tree, x, y, z) != expected) {
+                        fprintf(stderr, "version %u: streamed %u and tree %u disagree with %u at %u %u %u\n", test_chunk_formats[n].version,
+                                chunk_get_block_data(&streamed, x, y, z), chunk_get_block_data(&tree, x, y, z), expected, x, y, z);
+                        abort();
+                    }
+                }
+        assert(memcmp(streamed.column_min, tree.column_min, sizeof(tree.column_min)) == 0);
+        assert(memcmp(streamed.column_max, tree.column_max, sizeof(tree.column_max)) == 0);
+        enkl_destroy_chunk_data(&streamed);
+        enkl_destroy_chunk_data(&tree);
+    }
+
+    enkl_close_region(region);
+    cunk_close_mcworld(world);
+    remove(region_path);
+    free(region_path);
+    destroy_test_world(&test_world);
+    printf("stream loader: ok\n");
+}
+
+static void check_section_blocks(const ChunkData* chunk, unsigned section, const BlockData* expected) {
+    BlockData blocks[CUNK_SECTION_BLOCKS_COUNT];
+    chunk_read_section_blocks(chunk, section, blocks);
+    for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+        unsigned x = i % 16, z = i / 16 % 16, y = section * 16 + i / 256;
+        if (blocks[i] != expected[i] || chunk_get_block_data(chunk, x, y, z) != expected[i]) {
+            fprintf(stderr, "section %u has the wrong block at %zu\n", section, i);
+            abort();
+        }
+    }
+}
+
+/// Bits per block a section needs for that many different blocks
+static unsigned section_bits(size_t palette_size) {
+    const unsigned widths[] = { 0, 1, 2, 4, 8 };
+    for (int i = 0; i < 5; i++)
+        if (palette_size <= (size_t) 1 << widths[i])
+            return widths[i];
+    return 32;
+}
+
+static void check_section_storage(void) {
+    BlockData expected[CUNK_SECTION_BLOCKS_COUNT];
+    uint64_t seed = 2;
+
+    // whole sections with every width, then one block set in each of them
+    const size_t palette_sizes[] = { 1, 2, 3, 4, 16, 17, 256, 257, 300 };
+    for (size_t p = 0; p < sizeof(palette_sizes) / sizeof(palette_sizes[0]); p++) {
+        size_t palette_size = palette_sizes[p];
+        BlockData palette[300];
+        for (size_t i = 0; i < palette_size; i++)
+            palette[i] = (BlockData) (0x1000 + i);
+        uint16_t indices[CUNK_SECTION_BLOCKS_COUNT];
+        // every entry once, then random ones
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++)
+            indices[i] = (uint16_t) (i < palette_size ? i : next_random(&seed) % palette_size);
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++)
+            expected[i] = palette[indices[i]];
+
+        ChunkData chunk = { 0 };
+        chunk_set_section_paletted(&chunk, 3, palette_size, palette, indices);
+        ChunkSectionView view = chunk_get_section_view(&chunk, 3);
+        assert(view.bits == section_bits(palette_size));
+        assert(view.kind == (view.bits == 0 ? ChunkSectionUniform : view.bits == 32 ? ChunkSectionDirect : ChunkSectionPaletted));
+        check_section_blocks(&chunk, 3, expected);
+
+        chunk_set_section_blocks(&chunk, 5, expected);
+        assert(chunk_get_section_view(&chunk, 5).bits == view.bits);
+        check_section_blocks(&chunk, 5, expected);
+
+        chunk_set_block_data(&chunk, 7, 3 * 16 + 9, 2, 0x42);
+        expected[(9 * 16 + 2) * 16 + 7] = 0x42;
+        assert(chunk_get_section_view(&chunk, 3).bits == section_bits(palette_size + 1));
+        check_section_blocks(&chunk, 3, expected);
+        enkl_destroy_chunk_data(&chunk);
+    }
+
+    // one new block at a time, widening from a uniform section all the way to direct storage
+    ChunkData chunk = { 0 };
+    chunk_set_section_uniform(&chunk, 2, 0x2000);
+    assert(chunk_get_section_view(&chunk, 2).kind == ChunkSectionUniform);
+    for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++)
+        expected[i] = 0x2000;
+    for (unsigned n = 1; n < 300; n++) {
+        // 13 and 4096 have no common factor, so these never land on the same block twice
+        unsigned pos = n * 13 % CUNK_SECTION_BLOCKS_COUNT;
+        chunk_set_block_data(&chunk, pos % 16, 2 * 16 + pos / 256, pos / 16 % 16, 0x2000 + n);
+        expected[pos] = 0x2000 + n;
+        ChunkSectionView view = chunk_get_section_view(&chunk, 2);
+        assert(view.bits == section_bits(n + 1));
+        if (view.bits != section_bits(n))
+            check_section_blocks(&chunk, 2, expected);
+    }
+    check_section_blocks(&chunk, 2, expected);
+    enkl_destroy_chunk_data(&chunk);
+    printf("section storage: ok\n");
+}
+
+/// What a section view says is at index i of the section, read the way its doc says to
+static BlockData view_block(const ChunkSectionView* view, size_t i) {
+    if (view->kind == ChunkSectionNull || view->kind == ChunkSectionUniform)
+        return view->palette[0];
+    size_t per_word = 64 / view->bits;
+    uint64_t entry = view->words[i / per_word] >> (i % per_word * view->bits) & (((uint64_t) 1 << view->bits) - 1);
+    return view->kind == ChunkSectionDirect ? (BlockData) entry : view->palette[entry];
+}
+
+/// The bulk readers and section views all agree with chunk_get_block_data, whatever way the sections are stored
+static void check_bulk_readers(void) {
+    ChunkData chunk = { 0 };
+    uint64_t seed = 4;
+    // sections 0, 1 and the top one stay null
+    chunk_set_section_uniform(&chunk, 2, BlockStone);
+    const size_t palette_sizes[] = { 2, 3, 16, 17, 256, 300 };
+    for (size_t p = 0; p < sizeof(palette_sizes) / sizeof(palette_sizes[0]); p++) {
+        BlockData palette[300];
+        for (size_t i = 0; i < palette_sizes[p]; i++)
+            palette[i] = i == 0 ? BlockAir : (BlockData) (0x1000 + i);
+        uint16_t indices[CUNK_SECTION_BLOCKS_COUNT];
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++)
+            indices[i] = (uint16_t) (next_random(&seed) % palette_sizes[p]);
+        chunk_set_section_paletted(&chunk, 3 + p * 3, palette_sizes[p], palette, indices);
+    }
+
+    for (unsigned section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++) {
+        BlockData blocks[CUNK_SECTION_BLOCKS_COUNT];
+        chunk_read_section_blocks(&chunk, section, blocks);
+        ChunkSectionView view = chunk_get_section_view(&chunk, section);
+        BlockData uniform;
+        bool is_uniform = chunk_section_uniform_block(&chunk, section, &uniform);
+        assert(is_uniform == (view.kind == ChunkSectionNull || view.kind == ChunkSectionUniform));
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+            BlockData expected = chunk_get_block_data(&chunk, i % 16, section * 16 + i / 256, i / 16 % 16);
+            assert(blocks[i] == expected && view_block(&view, i) == expected);
+            assert(!is_uniform || uniform == expected);
+        }
+
+        for (unsigned n = 0; n < 16; n++) {
+            BlockData layer[CUNK_CHUNK_COLUMNS_COUNT], x_slice[CUNK_CHUNK_COLUMNS_COUNT], z_slice[CUNK_CHUNK_COLUMNS_COUNT];
+            chunk_read_section_layer(&chunk, section, n, layer);
+            chunk_read_section_x_slice(&chunk, section, n, x_slice);
+            chunk_read_section_z_slice(&chunk, section, n, z_slice);
+            for (unsigned a = 0; a < 16; a++)
+                for (unsigned b = 0; b < 16; b++) {
+                    assert(layer[a * 16 + b] == chunk_get_block_data(&chunk, b, section * 16 + n, a));
+                    assert(x_slice[a * 16 + b] == chunk_get_block_data(&chunk, n, section * 16 + a, b));
+                    assert(z_slice[a * 16 + b] == chunk_get_block_data(&chunk, b, section * 16 + a, n));
+                }
+        }
+    }
+
+    for (unsigned z = 0; z < 16; z++)
+        for (unsigned x = 0; x < 16; x++) {
+            BlockData column[CUNK_CHUNK_MAX_HEIGHT];
+            chunk_read_column(&chunk, x, z, column);
+            for (unsigned y = 0; y < CUNK_CHUNK_MAX_HEIGHT; y++)
+                assert(column[y] == chunk_get_block_data(&chunk, x, y, z));
+        }
+    enkl_destroy_chunk_data(&chunk);
+    printf("bulk readers: ok\n");
+}
+
+/// Every non-air block of a column lies in its bounds, and when exact is set they don't reach past the lowest and highest one either
+static void check_bounds_cover_blocks(const ChunkData* chunk, bool exact) {
+    for (unsigned column = 0; column < CUNK_CHUNK_COLUMNS_COUNT; column++) {
+        unsigned bottom = CUNK_CHUNK_MAX_HEIGHT, top = 0;
+        for (unsigned y = 0; y < CUNK_CHUNK_MAX_HEIGHT; y++)
+            if (chunk_get_block_data(chunk, column % 16, y, column / 16) != BlockAir) {
+                bottom = bottom < y ? bottom : y;
+                top = y + 1;
+            }
+        unsigned min = chunk->column_min[column], max = chunk->column_max[column];
+        if (top == 0)
+            assert(!exact || min >= max);
+        else
+            assert(exact ? min == bottom && max == top : min <= bottom && max >= top);
+    }
+}
+
+static void check_column_bounds(void) {
+    ChunkData chunk = { 0 };
+    uint64_t seed = 5;
+    chunk_set_section_uniform(&chunk, 4, BlockStone);
+    // mostly air, with the column at 0, 0 left all air
+    const size_t palette_sizes[] = { 2, 17, 300 };
+    for (size_t p = 0; p < sizeof(palette_sizes) / sizeof(palette_sizes[0]); p++) {
+        BlockData palette[300];
+        for (size_t i = 0; i < palette_sizes[p]; i++)
+            palette[i] = i == 0 ? BlockAir : (BlockData) (0x1000 + i);
+        uint16_t indices[CUNK_SECTION_BLOCKS_COUNT];
+        for (size_t i = 0; i < CUNK_SECTION_BLOCKS_COUNT; i++) {
+            uint64_t r = next_random(&seed);
+            indices[i] = (uint16_t) (i % CUNK_CHUNK_COLUMNS_COUNT == 0 || r % 16 != 0 ? 0 : 1 + r / 16 % (palette_sizes[p] - 1));
+        }
+        chunk_set_section_paletted(&chunk, 8 + p * 5, palette_sizes[p], palette, indices);
+    }
+    check_bounds_cover_blocks(&chunk, false);
+    // the stone section spans every column, without it bounds built from scratch are exact and the column at 0, 0 is empty
+    chunk_set_section_uniform(&chunk, 4, BlockAir);
+    ChunkData reloaded = { 0 };
+    for (unsigned section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++) {
+        BlockData blocks[CUNK_SECTION_BLOCKS_COUNT];
+        chunk_read_section_blocks(&chunk, section, blocks);
+        chunk_set_section_blocks(&reloaded, section, blocks);
+    }
+    check_bounds_cover_blocks(&reloaded, true);
+
+    // single blocks only ever widen them
+    for (int n = 0; n < 500; n++) {
+        uint64_t r = next_random(&seed);
+        BlockData block = r % 3 == 0 ? BlockAir : BlockDirt;
+        chunk_set_block_data(&reloaded, r / 4 % 16, r / 64 % CUNK_CHUNK_MAX_HEIGHT, r / 65536 % 16, block);
+        if (n % 50 == 49)
+            check_bounds_cover_blocks(&reloaded, false);
+    }
+    enkl_destroy_chunk_data(&chunk);
+    enkl_destroy_chunk_data(&reloaded);
+    printf("column bounds: ok\n");
+}
+
+#define POOL_TEST_CLASS 2
+#define POOL_TEST_SIZE 128
+#define POOL_TEST_BLOCKS 40
+
+/// Acquires and releases a bunch of blocks, then exits, which hands all of them to the shared lists
+static int pool_test_thread(void* uptr) {
+    (void) uptr;
+    void* blocks[POOL_TEST_BLOCKS];
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++) {
+        blocks[i] = enkl_section_pool_acquire(POOL_TEST_CLASS, POOL_TEST_SIZE);
+        memset(blocks[i], i, POOL_TEST_SIZE);
+    }
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++)
+        enkl_section_pool_release(POOL_TEST_CLASS, POOL_TEST_SIZE, blocks[i]);
+    return 0;
+}
+
+/// Only acquires, so whatever it took from the shared lists along with its block is handed back at a size it never released at
+static int pool_acquire_thread(void* uptr) {
+    *(void**) uptr = enkl_section_pool_acquire(POOL_TEST_CLASS, POOL_TEST_SIZE);
+    return 0;
+}
+
+static int pool_release_thread(void* uptr) {
+    enkl_section_pool_release(POOL_TEST_CLASS, POOL_TEST_SIZE, *(void**) uptr);
+    return 0;
+}
+
+static void run_pool_test_thread_with(thrd_start_t fn, void* uptr) {
+    thrd_t thread;
+    int ret = thrd_create(&thread, fn, uptr);
+    assert(ret == thrd_success);
+    thrd_join(thread, NULL);
+}
+
+static void run_pool_test_thread(void) {
+    run_pool_test_thread_with(pool_test_thread, NULL);
+}
+
+static void check_section_pool(void) {
+    // start with empty shared lists, what this thread cached for itself stays as it is throughout
+    enkl_trim_section_pool();
+    Enkl_SectionPoolStats before, after;
+    enkl_get_section_pool_stats(&before);
+
+    run_pool_test_thread();
+    enkl_get_section_pool_stats(&after);
+    assert(after.live_sections == before.live_sections && after.live_bytes == before.live_bytes);
+    assert(after.peak_live_bytes >= before.live_bytes + POOL_TEST_BLOCKS * POOL_TEST_SIZE);
+    assert(after.allocated == before.allocated + POOL_TEST_BLOCKS && after.reused == before.reused);
+    assert(after.cached_bytes == before.cached_bytes + POOL_TEST_BLOCKS * POOL_TEST_SIZE);
+
+    // the next thread gets all of its blocks from the shared lists
+    run_pool_test_thread();
+    Enkl_SectionPoolStats reused;
+    enkl_get_section_pool_stats(&reused);
+    assert(reused.allocated == after.allocated && reused.reused == after.reused + POOL_TEST_BLOCKS);
+    assert(reused.cached_bytes == after.cached_bytes);
+
+    // a block can be released on another thread than the one that acquired it
+    void* block = NULL;
+    run_pool_test_thread_with(pool_acquire_thread, &block);
+    assert(block);
+    run_pool_test_thread_with(pool_release_thread, &block);
+    Enkl_SectionPoolStats handed_over;
+    enkl_get_section_pool_stats(&handed_over);
+    assert(handed_over.live_sections == before.live_sections && handed_over.cached_bytes == reused.cached_bytes);
+    assert(handed_over.allocated == reused.allocated && handed_over.reused == reused.reused + 1);
+
+    enkl_trim_section_pool();
+    Enkl_SectionPoolStats trimmed;
+    enkl_get_section_pool_stats(&trimmed);
+    assert(trimmed.cached_bytes == before.cached_bytes && trimmed.live_bytes == before.live_bytes);
+    printf("section pool: ok\n");
+}
+
+#define KEY_TEST_CHILDREN 40
+
+/// Looking children up by key finds what looking them up by name does, in compounds with and without a hash index
+static void check_compound_keys(void) {
+    const int children_counts[] = { 3, NBT_COMPOUND_INDEX_THRESHOLD + 1, KEY_TEST_CHILDREN };
+    for (size_t c = 0; c < sizeof(children_counts) / sizeof(children_counts[0]); c++) {
+        int children = children_counts[c];
+        TestBuffer b = { .size = 0 };
+        put_named(&b, NBT_Tag_Compound, "");
+        char names[KEY_TEST_CHILDREN][16];
+        for (int i = 0; i < children; i++) {
+            snprintf(names[i], sizeof(names[i]), i % 2 ? "child%d" : "c%d", i);
+            put_named(&b, NBT_Tag_Int, names[i]);
+            put_be(&b, (uint64_t) i, 4);
+        }
+        put_be(&b, NBT_Tag_End, 1);
+
+        for (int mode = NBT_Decode_Copy; mode <= NBT_Decode_View; mode++) {
+            Enkl_Allocator malloc_allocator = enkl_get_malloc_free_allocator();
+            Enkl_Arena* arena = enkl_create_arena(&malloc_allocator, 4096);
+            NBT_Object* root = cunk_decode_nbt_with_mode(b.size, (const char*) b.bytes, mode, enkl_get_arena_allocator(arena));
+            assert(root);
+            const NBT_Compound* compound = cunk_nbt_extract_compound(root);
+            assert(compound && compound->count == children);
+
+            NBT_Key keys[KEY_TEST_CHILDREN + 2];
+            for (int i = 0; i < children; i++) {
+                keys[i] = cunk_nbt_make_key(names[i]);
+                const NBT_Object* found = cunk_nbt_compound_find(compound, &keys[i]);
+                assert(found && found == cunk_nbt_compound_direct_access(compound, names[i]));
+                assert(*cunk_nbt_extract_int(found) == i);
+            }
+            // a name that's a prefix of others, and one that isn't there at all
+            keys[children] = cunk_nbt_make_key("child");
+            keys[children + 1] = cunk_nbt_make_key("missing");
+            assert(!cunk_nbt_compound_find(compound, &keys[children]) && !cunk_nbt_compound_find(compound, &keys[children + 1]));
+
+            // in reverse order, so the single pass doesn't get them in the order of the children
+            NBT_Key reversed[KEY_TEST_CHILDREN + 2];
+            for (int i = 0; i < children + 2; i++)
+                reversed[i] = keys[children + 1 - i];
+            const NBT_Object* found[KEY_TEST_CHILDREN + 2];
+            cunk_nbt_compound_find_many(compound, children + 2, reversed, found);
+            assert(!found[0] && !found[1]);
+            for (int i = 2; i < children + 2; i++)
+                assert(found[i] && *cunk_nbt_extract_int(found[i]) == children + 1 - i);
+            enkl_destroy_arena(arena);
+        }
+    }
+    printf("compound keys: ok\n");
+}
+
+#define SWAP_TEST_MAX_COUNT 40
+
+/// The bulk byte swaps reverse every value whatever the count (and so whichever of the vector loops and the scalar tail handle it) and alignment, in place or not
+static void check_byte_swaps(void) {
+    uint64_t seed = 6;
+    for (unsigned width = 4; width <= 8; width += 4) {
+        for (size_t count = 0; count <= SWAP_TEST_MAX_COUNT; count++) {
+            for (size_t offset = 0; offset < 8; offset += 3) {
+                uint8_t src[SWAP_TEST_MAX_COUNT * 8 + 8], dst[SWAP_TEST_MAX_COUNT * 8 + 16];
+                for (size_t i = 0; i < sizeof(src); i++)
+                    src[i] = (uint8_t) next_random(&seed);
+                memset(dst, 0xAA, sizeof(dst));
+                uint8_t in_place[sizeof(src)];
+                memcpy(in_place, src, sizeof(src));
+
+                if (width == 4) {
+                    enkl_swap_endianness_32(dst + offset, src + offset, count);
+                    enkl_swap_endianness_32(in_place + offset, in_place + offset, count);
+                } else {
+                    enkl_swap_endianness_64(dst + offset, src + offset, count);
+                    enkl_swap_endianness_64(in_place + offset, in_place + offset, count);
+                }
+                for (size_t i = 0; i < count * width; i++) {
+                    uint8_t expected = src[offset + i / width * width + (width - 1 - i % width)];
+                    assert(dst[offset + i] == expected && in_place[offset + i] == expected);
+                }
+                // nothing written past the end
+                for (size_t i = offset + count * width; i < sizeof(dst); i++)
+                    assert(dst[i] == 0xAA);
+            }
+        }
+    }
+
+    // and the arrays of a decoded tree come out in native order
+    TestBuffer b = { .size = 0 };
+    put_named(&b, NBT_Tag_Compound, "");
+    put_named(&b, NBT_Tag_IntArray, "ints");
+    put_be(&b, SWAP_TEST_MAX_COUNT, 4);
+    for (int i = 0; i < SWAP_TEST_MAX_COUNT; i++)
+        put_be(&b, (uint32_t) (i * 0x01020304), 4);
+    put_named(&b, NBT_Tag_LongArray, "longs");
+    put_be(&b, SWAP_TEST_MAX_COUNT, 4);
+    for (int i = 0; i < SWAP_TEST_MAX_COUNT; i++)
+        put_be(&b, (uint64_t) i * 0x0102030405060708u, 8);
+    put_be(&b, NBT_Tag_End, 1);
+    Enkl_Allocator allocator = enkl_get_malloc_free_allocator();
+    NBT_Object* root = cunk_decode_nbt(b.size, (const char*) b.bytes, &allocator);
+    assert(root);
+    int32_t ints[SWAP_TEST_MAX_COUNT];
+    int64_t longs[SWAP_TEST_MAX_COUNT];
+    cunk_nbt_int_array_to_native(cunk_nbt_extract_int_array(cunk_nbt_compound_access(root, "ints")), ints);
+    cunk_nbt_long_array_to_native(cunk_nbt_extract_long_array(cunk_nbt_compound_access(root, "longs")), longs);
+    for (int i = 0; i < SWAP_TEST_MAX_COUNT; i++)
+        assert((uint32_t) ints[i] == (uint32_t) (i * 0x01020304) && (uint64_t) longs[i] == (uint64_t) i * 0x0102030405060708u);
+    enkl_free_nbt(root, &allocator);
+    printf("byte swaps: ok\n");
+}
 
 int main(int argc, char** argv) {
     Enkl_FilePrinter p = enkl_get_default_printer();
     Enkl_Allocator allocator = enkl_get_malloc_free_allocator();
 
+    check_unpack();
+    check_lz4_blocks();
+    check_gzip_size_hint();
+    check_external_chunks();
+    check_region_bounds();
+    check_stream_loader();
+    check_section_storage();
+    check_bulk_readers();
+    check_column_bounds();
+    check_section_pool();
+    check_compound_keys();
+    check_byte_swaps();
+
+    if (argc < 2) {
+        printf("no world given, skipping the checks that need one\n");
+        return 0;
+    }
+
     McWorld* w = cunk_open_mcworld(argv[1], &allocator);
     assert(w);
 
+    McRegionIndex index;
+    bool index_ok = cunk_scan_mcregion_index(w, 0, 0, &index);
+    assert(index_ok);
+    int present = 0;
+    for (unsigned z = 0; z < 32; z++)
+        for (unsigned x = 0; x < 32; x++)
+            present += cunk_mcregion_index_has_chunk(&index, x, z);
+    printf("region 0 0 holds %d chunks\n", present);
+
     McRegion* r = cunk_open_mcregion(w, 0, 0);
     assert(r);
     McChunk* c = cunk_open_mcchunk(r, 0, 0);
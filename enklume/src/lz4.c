@@ -0,0 +1,196 @@
+#include "support_private.h"
+
+#include <string.h>
+
+// Minecraft writes LZ4 chunks through lz4-java's LZ4BlockOutputStream, which is neither the LZ4 frame format nor a bare block:
+// every block gets a 21 byte header (magic, method, compressed/original length and a checksum), and an empty block ends the stream.
+
+#define LZ4_BLOCK_MAGIC "LZ4Block"
+#define LZ4_BLOCK_MAGIC_SIZE 8
+#define LZ4_BLOCK_HEADER_SIZE (LZ4_BLOCK_MAGIC_SIZE + 1 + 4 + 4 + 4)
+
+#define LZ4_METHOD_RAW 0x10
+#define LZ4_METHOD_LZ4 0x20
+
+#define LZ4_CHECKSUM_SEED 0x9747b28cu
+
+static uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+#define XXH_PRIME32_1 2654435761u
+#define XXH_PRIME32_2 2246822519u
+#define XXH_PRIME32_3 3266489917u
+#define XXH_PRIME32_4 668265263u
+#define XXH_PRIME32_5 374761393u
+
+static uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t xxh32_round(uint32_t acc, uint32_t lane) {
+    acc += lane * XXH_PRIME32_2;
+    acc = rotl32(acc, 13);
+    return acc * XXH_PRIME32_1;
+}
+
+static uint32_t xxh32(const uint8_t* data, size_t size, uint32_t seed) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint32_t h;
+    if (size >= 16) {
+        uint32_t v1 = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+        uint32_t v2 = seed + XXH_PRIME32_2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - XXH_PRIME32_1;
+        do {
+            v1 = xxh32_round(v1, read_le32(p));
+            v2 = xxh32_round(v2, read_le32(p + 4));
+            v3 = xxh32_round(v3, read_le32(p + 8));
+            v4 = xxh32_round(v4, read_le32(p + 12));
+            p += 16;
+        } while (p + 16 <= end);
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = seed + XXH_PRIME32_5;
+    }
+    h += (uint32_t) size;
+    for (; p + 4 <= end; p += 4)
+        h = rotl32(h + read_le32(p) * XXH_PRIME32_3, 17) * XXH_PRIME32_4;
+    for (; p < end; p++)
+        h = rotl32(h + *p * XXH_PRIME32_5, 11) * XXH_PRIME32_1;
+    h ^= h >> 15;
+    h *= XXH_PRIME32_2;
+    h ^= h >> 13;
+    h *= XXH_PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+/// Decodes one raw LZ4 block, which has to expand to exactly dst_size bytes.
+static bool lz4_decompress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_size;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t) (iend - ip) || literals > (size_t) (oend - op))
+            return false;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence only has literals
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = (size_t) ip[0] | (size_t) ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst))
+            return false;
+
+        size_t match = token & 15;
+        if (match == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+        match += 4;
+        if (match > (size_t) (oend - op))
+            return false;
+
+        const uint8_t* from = op - offset;
+        if (offset >= match) {
+            memcpy(op, from, match);
+            op += match;
+        } else {
+            // overlapping copy, repeats the last offset bytes
+            for (size_t i = 0; i < match; i++)
+                *op++ = *from++;
+        }
+    }
+
+    return op == oend;
+}
+
+bool enkl_lz4_block_stream_size(size_t src_size, const void* input_data, size_t* output_size) {
+    const uint8_t* src = input_data;
+    const uint8_t* const end = src + src_size;
+
+    size_t total = 0;
+    for (const uint8_t* p = src; end - p >= LZ4_BLOCK_HEADER_SIZE; ) {
+        if (memcmp(p, LZ4_BLOCK_MAGIC, LZ4_BLOCK_MAGIC_SIZE) != 0)
+            return false;
+        uint32_t compressed_size = read_le32(p + 9);
+        uint32_t original_size = read_le32(p + 13);
+        if (original_size == 0)
+            break;
+        total += original_size;
+        p += LZ4_BLOCK_HEADER_SIZE;
+        if (compressed_size > (size_t) (end - p))
+            return false;
+        p += compressed_size;
+    }
+
+    *output_size = total;
+    return total > 0;
+}
+
+bool enkl_lz4_block_stream_decode(size_t src_size, const void* input_data, size_t output_size, void* output) {
+    const uint8_t* p = input_data;
+    const uint8_t* const end = p + src_size;
+    uint8_t* dst = output;
+    size_t size = 0;
+    while (size < output_size) {
+        if (end - p < LZ4_BLOCK_HEADER_SIZE)
+            return false;
+        unsigned method = p[LZ4_BLOCK_MAGIC_SIZE] & 0xF0;
+        uint32_t compressed_size = read_le32(p + 9);
+        uint32_t original_size = read_le32(p + 13);
+        uint32_t checksum = read_le32(p + 17);
+        p += LZ4_BLOCK_HEADER_SIZE;
+        if (original_size > output_size - size || compressed_size > (size_t) (end - p))
+            return false;
+
+        switch (method) {
+            case LZ4_METHOD_RAW:
+                if (compressed_size != original_size)
+                    return false;
+                memcpy(dst + size, p, original_size);
+                break;
+            case LZ4_METHOD_LZ4:
+                if (!lz4_decompress_block(p, compressed_size, dst + size, original_size))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+
+        // lz4-java only keeps the low 28 bits of the hash
+        if ((xxh32(dst + size, original_size, LZ4_CHECKSUM_SEED) & 0x0FFFFFFF) != checksum)
+            return false;
+
+        size += original_size;
+        p += compressed_size;
+    }
+    return true;
+}
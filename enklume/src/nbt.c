@@ -16,82 +16,195 @@ static const char* validate_in_bounds(const char* buf, const char* bound, size_t
     return buf + off;
 }
 
-#define read(T) (T) enkl_swap_endianness(sizeof(T), *(T*) ((*buffer = validate_in_bounds(*buffer, buffer_end, sizeof(T))) - sizeof(T)) )
+/// The buffer has no alignment guarantees, especially since views may point anywhere in it.
+/// size is always a constant, so this folds down to a load and a bswap instruction.
+static inline int64_t load_big_endian(const char* p, size_t size) {
+    switch (size) {
+        case 1: return (uint8_t) *p;
+        case 2: { uint16_t v; memcpy(&v, p, 2); return enkl_bswap16(v); }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return enkl_bswap32(v); }
+        case 8: { uint64_t v; memcpy(&v, p, 8); return (int64_t) enkl_bswap64(v); }
+        default: assert(false); return 0;
+    }
+}
+
+#define read(T) (T) load_big_endian((*buffer = validate_in_bounds(*buffer, buffer_end, sizeof(T))) - sizeof(T), sizeof(T))
 #define advance_bytes(b) ((*buffer = validate_in_bounds(*buffer, buffer_end, (b))) - (b))
 
-static NBT_Object* cunk_decode_nbt_impl(const char*, const char*, const char**, Enkl_Allocator*);
+typedef struct {
+    const char* buffer_start;
+    const char* buffer_end;
+    NBT_DecodeMode mode;
+    Enkl_Allocator* allocator;
+} DecodeContext;
+
+static NBT_Object* cunk_decode_nbt_impl(const DecodeContext*, const char**);
+
+/// FNV-1a
+static uint32_t hash_name(const char* chars, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// The index of a compound with count children: a power of two sized open-addressed table of child index + 1 (0 is empty), at most half full
+static size_t compound_index_size(int32_t count) {
+    size_t size = 16;
+    while (size < (size_t) count * 2)
+        size *= 2;
+    return size;
+}
+
+static bool has_compound_index(const NBT_Compound* c) {
+    return c->count > NBT_COMPOUND_INDEX_THRESHOLD && c->count < UINT16_MAX;
+}
+
+static uint16_t* get_compound_index(const NBT_Compound* c) {
+    return (uint16_t*) (c->objects + c->count);
+}
+
+static void build_compound_index(const NBT_Compound* c) {
+    uint16_t* index = get_compound_index(c);
+    size_t mask = compound_index_size(c->count) - 1;
+    memset(index, 0, sizeof(uint16_t) * (mask + 1));
+    for (int32_t i = 0; i < c->count; i++) {
+        size_t slot = c->objects[i]->name_hash & mask;
+        // keep the first of duplicate names, like a linear scan would
+        while (index[slot] != 0)
+            slot = (slot + 1) & mask;
+        index[slot] = (uint16_t) (i + 1);
+    }
+}
+
+/// Copies size bytes out of the buffer in copy mode (aligned, and zero-terminated for strings), or just points at them in view mode
+static const void* decode_bytes(const DecodeContext* ctx, const char** const buffer, size_t size, size_t alignment, bool terminate) {
+    const char* const buffer_end = ctx->buffer_end;
+    const char* src = advance_bytes(size);
+    if (ctx->mode == NBT_Decode_View)
+        return src;
+    Enkl_Allocator* allocator = ctx->allocator;
+    char* copy = allocator->allocate_bytes(allocator, terminate ? size + 1 : size, alignment);
+    memcpy(copy, src, size);
+    if (terminate)
+        copy[size] = '\0';
+    return copy;
+}
 
-static bool cunk_decode_nbt_body(NBT_Tag tag, NBT_Body* out_body, const char* buffer_start, const char* const buffer_end, const char** const buffer, Enkl_Allocator* allocator) {
+/// Int and long arrays get byte-swapped in bulk while being copied out, views are left as they are
+static const void* decode_numeric_array(const DecodeContext* ctx, const char** const buffer, int32_t count, size_t element_size, bool* native_endian) {
+    const char* const buffer_end = ctx->buffer_end;
+    const char* src = advance_bytes(element_size * count);
+    if (ctx->mode == NBT_Decode_View) {
+        *native_endian = false;
+        return src;
+    }
+    Enkl_Allocator* allocator = ctx->allocator;
+    void* copy = allocator->allocate_bytes(allocator, element_size * count, element_size);
+    if (element_size == sizeof(int32_t))
+        enkl_swap_endianness_32(copy, src, count);
+    else
+        enkl_swap_endianness_64(copy, src, count);
+    *native_endian = true;
+    return copy;
+}
+
+static NBT_String decode_string(const DecodeContext* ctx, const char** const buffer) {
+    const char* const buffer_end = ctx->buffer_end;
+    uint16_t size = read(uint16_t);
+    return (NBT_String) {
+        .length = size,
+        .chars = decode_bytes(ctx, buffer, size, alignof(char), true),
+    };
+}
+
+static bool cunk_decode_nbt_body(NBT_Tag tag, NBT_Body* out_body, const DecodeContext* ctx, const char** const buffer) {
+    const char* const buffer_end = ctx->buffer_end;
+    Enkl_Allocator* allocator = ctx->allocator;
     NBT_Body body = { 0 };
     switch (tag) {
         case NBT_Tag_Byte:   body.p_byte   = read(int8_t);  break;
         case NBT_Tag_Short:  body.p_short  = read(int16_t); break;
         case NBT_Tag_Int:    body.p_int    = read(int32_t); break;
         case NBT_Tag_Long:   body.p_long   = read(int64_t); break;
-        case NBT_Tag_Float:  body.p_float  = read(float);   break;
-        case NBT_Tag_Double: body.p_double = read(double);  break;
+        case NBT_Tag_Float: {
+            int32_t bits = read(int32_t);
+            memcpy(&body.p_float, &bits, sizeof(float));
+            break;
+        }
+        case NBT_Tag_Double: {
+            int64_t bits = read(int64_t);
+            memcpy(&body.p_double, &bits, sizeof(double));
+            break;
+        }
         case NBT_Tag_ByteArray: {
             int32_t size = body.p_byte_array.count = read(int32_t);
             assert(size >= 0);
-            int8_t* data = body.p_byte_array.arr = allocator->allocate_bytes(allocator, sizeof(int8_t) * size, 0);
-            memcpy(data, *buffer, sizeof(int8_t) * size);
-            advance_bytes(sizeof(int8_t) * size);
+            body.p_byte_array.arr = decode_bytes(ctx, buffer, sizeof(int8_t) * size, alignof(int8_t), false);
             break;
         } case NBT_Tag_String: {
-            uint16_t size = read(uint16_t);
-            char* str;
-            body.p_string = str = allocator->allocate_bytes(allocator, size + 1, 0);
-            memcpy(str, *buffer, size * sizeof(int8_t));
-            advance_bytes(size * sizeof(int8_t));
-            str[size] = '\0';
+            body.p_string = decode_string(ctx, buffer);
             break;
         }
         case NBT_Tag_List: {
             NBT_Tag elements_tag = body.p_list.tag = read(uint8_t);
             int32_t elements_count = body.p_list.count = read(int32_t);
             assert(elements_count >= 0);
-            NBT_Body* arr = body.p_list.bodies = allocator->allocate_bytes(allocator, sizeof(NBT_Body) * elements_count, 0);
+            NBT_Body* arr = body.p_list.bodies = allocator->allocate_bytes(allocator, sizeof(NBT_Body) * elements_count, alignof(NBT_Body));
             for (int32_t i = 0; i < elements_count; i++) {
-                bool list_item_decoded_ok = cunk_decode_nbt_body(elements_tag, &arr[i], buffer_start, buffer_end, buffer, allocator);
+                bool list_item_decoded_ok = cunk_decode_nbt_body(elements_tag, &arr[i], ctx, buffer);
                 assert(list_item_decoded_ok);
             }
             break;
         }
         case NBT_Tag_Compound: {
-            size_t space = 8;
-            body.p_compound.objects = allocator->allocate_bytes(allocator, sizeof(NBT_Object*) * space, alignof(NBT_Object*));
+            // gather the children on the stack first, so the array is allocated once at its final size in the common case
+            NBT_Object* local[32];
+            NBT_Object** objects = local;
+            size_t space = sizeof(local) / sizeof(local[0]);
             int32_t size = 0;
             while (true) {
-                NBT_Object* o = cunk_decode_nbt_impl(buffer_start, buffer_end, buffer, allocator);
+                NBT_Object* o = cunk_decode_nbt_impl(ctx, buffer);
                 if (!o)
                     break;
-                size++;
-                if (size >= space) {
-                    body.p_compound.objects = allocator->grow_allocation(allocator, body.p_compound.objects, alignof(NBT_Object*), sizeof(NBT_Object*) * space, sizeof(NBT_Object*) * space * 2);
+                if (size == space) {
+                    if (objects == local) {
+                        objects = allocator->allocate_bytes(allocator, sizeof(NBT_Object*) * space * 2, alignof(NBT_Object*));
+                        memcpy(objects, local, sizeof(local));
+                    } else
+                        objects = allocator->grow_allocation(allocator, objects, alignof(NBT_Object*), sizeof(NBT_Object*) * space, sizeof(NBT_Object*) * space * 2);
                     space *= 2;
                 }
-                body.p_compound.objects[size - 1] = o;
+                objects[size++] = o;
             }
+            NBT_Compound compound = { .count = size };
+            size_t index_bytes = has_compound_index(&compound) ? sizeof(uint16_t) * compound_index_size(size) : 0;
+            if (objects == local || index_bytes > 0) {
+                NBT_Object** sized = allocator->allocate_bytes(allocator, sizeof(NBT_Object*) * (size > 0 ? size : 1) + index_bytes, alignof(NBT_Object*));
+                memcpy(sized, objects, sizeof(NBT_Object*) * size);
+                if (objects != local)
+                    allocator->free_bytes(allocator, objects);
+                objects = sized;
+            }
+            compound.objects = objects;
+            if (index_bytes > 0)
+                build_compound_index(&compound);
+            body.p_compound.objects = objects;
             body.p_compound.count = size;
             break;
         }
         case NBT_Tag_IntArray: {
             int32_t size = body.p_int_array.count = read(int32_t);
             assert(size >= 0);
-            int32_t* data = body.p_int_array.arr = allocator->allocate_bytes(allocator, sizeof(int32_t) * size, 0);
-            memcpy(data, *buffer, sizeof(int32_t) * size);
-            advance_bytes(sizeof(int32_t) * size);
+            body.p_int_array.arr = decode_numeric_array(ctx, buffer, size, sizeof(int32_t), &body.p_int_array.native_endian);
             break;
         }
         case NBT_Tag_LongArray: {
             int32_t size = body.p_long_array.count = read(int32_t);
             assert(size >= 0);
-            int64_t* data = body.p_long_array.arr = allocator->allocate_bytes(allocator, sizeof(int64_t) * size, 0);
-            memcpy(data, *buffer, sizeof(int64_t) * size);
-            advance_bytes(sizeof(int64_t) * size);
-            for (size_t i = 0; i < size; i++) {
-                // data[i] = swap_endianness(8, data[i]);
-            }
+            body.p_long_array.arr = decode_numeric_array(ctx, buffer, size, sizeof(int64_t), &body.p_long_array.native_endian);
             break;
         }
         default:
@@ -112,10 +225,10 @@ static void free_nbt_body(NBT_Tag tag, NBT_Body* body, Enkl_Allocator* allocator
         case NBT_Tag_Double:
             break;
         case NBT_Tag_ByteArray:
-            allocator->free_bytes(allocator, body->p_byte_array.arr);
+            allocator->free_bytes(allocator, (void*) body->p_byte_array.arr);
             break;
         case NBT_Tag_String:
-            allocator->free_bytes(allocator, (void*) body->p_string);
+            allocator->free_bytes(allocator, (void*) body->p_string.chars);
             break;
         case NBT_Tag_List: {
             for (size_t i = 0; i < body->p_list.count; i++) {
@@ -133,54 +246,287 @@ static void free_nbt_body(NBT_Tag tag, NBT_Body* body, Enkl_Allocator* allocator
             break;
         }
         case NBT_Tag_IntArray:
-            allocator->free_bytes(allocator, body->p_int_array.arr);
+            allocator->free_bytes(allocator, (void*) body->p_int_array.arr);
             break;
         case NBT_Tag_LongArray:
-            allocator->free_bytes(allocator, body->p_long_array.arr);
+            allocator->free_bytes(allocator, (void*) body->p_long_array.arr);
             break;
     }
 }
 
 void enkl_free_nbt(NBT_Object* o, Enkl_Allocator* allocator) {
     free_nbt_body(o->tag, &o->body, allocator);
-    allocator->free_bytes(allocator, (void*) o->name);
+    allocator->free_bytes(allocator, (void*) o->name.chars);
     allocator->free_bytes(allocator, o);
 }
 
-static NBT_Object* cunk_decode_nbt_impl(const char* buffer_start, const char* const buffer_end, const char** const buffer, Enkl_Allocator* allocator) {
+static NBT_Object* cunk_decode_nbt_impl(const DecodeContext* ctx, const char** const buffer) {
+    const char* const buffer_end = ctx->buffer_end;
     NBT_Tag tag = read(uint8_t);
     if (tag == NBT_Tag_End)
         return NULL;
 
-    NBT_Object* o = allocator->allocate_bytes(allocator, sizeof(NBT_Object), 0);
+    Enkl_Allocator* allocator = ctx->allocator;
+    NBT_Object* o = allocator->allocate_bytes(allocator, sizeof(NBT_Object), alignof(NBT_Object));
     o->tag = tag;
+    o->name = decode_string(ctx, buffer);
+    o->name_hash = hash_name(o->name.chars, o->name.length);
 
-    uint16_t name_size = read(uint16_t);
-    char* name = allocator->allocate_bytes(allocator, name_size + 1, 0);
-    memcpy(name, *buffer, name_size * sizeof(int8_t));
-    advance_bytes(name_size * sizeof(int8_t));
-    name[name_size] = '\0';
-    o->name = name;
-
-    bool body_ok = cunk_decode_nbt_body(tag, &o->body, buffer_start, buffer_end, buffer, allocator);
+    bool body_ok = cunk_decode_nbt_body(tag, &o->body, ctx, buffer);
     assert(body_ok);
     return o;
 }
 
+NBT_Object* cunk_decode_nbt_with_mode(size_t buffer_size, const char* buffer, NBT_DecodeMode mode, Enkl_Allocator* allocator) {
+    DecodeContext ctx = {
+        .buffer_start = buffer,
+        .buffer_end = buffer + buffer_size,
+        .mode = mode,
+        .allocator = allocator,
+    };
+    return cunk_decode_nbt_impl(&ctx, &buffer);
+}
+
 NBT_Object* cunk_decode_nbt(size_t buffer_size, const char* buffer, Enkl_Allocator* allocator) {
-    return cunk_decode_nbt_impl(buffer, buffer + buffer_size, &buffer, allocator);
+    return cunk_decode_nbt_with_mode(buffer_size, buffer, NBT_Decode_Copy, allocator);
 }
 
-const NBT_Object* cunk_nbt_compound_direct_access(const NBT_Compound* c, const char* name) {
-    assert(name);
+static size_t fixed_body_size(NBT_Tag tag) {
+    switch (tag) {
+        case NBT_Tag_End:    return 0;
+        case NBT_Tag_Byte:   return sizeof(int8_t);
+        case NBT_Tag_Short:  return sizeof(int16_t);
+        case NBT_Tag_Int:
+        case NBT_Tag_Float:  return sizeof(int32_t);
+        case NBT_Tag_Long:
+        case NBT_Tag_Double: return sizeof(int64_t);
+        default:             return 0;
+    }
+}
+
+/// Steps over a body using the lengths in the stream, without looking at the contents
+static void skip_nbt_body(NBT_Tag tag, const char* const buffer_end, const char** const buffer) {
+    switch (tag) {
+        case NBT_Tag_End:
+            break;
+        case NBT_Tag_Byte:
+        case NBT_Tag_Short:
+        case NBT_Tag_Int:
+        case NBT_Tag_Long:
+        case NBT_Tag_Float:
+        case NBT_Tag_Double:
+            advance_bytes(fixed_body_size(tag));
+            break;
+        case NBT_Tag_ByteArray: {
+            int32_t size = read(int32_t);
+            assert(size >= 0);
+            advance_bytes(sizeof(int8_t) * size);
+            break;
+        }
+        case NBT_Tag_String: {
+            uint16_t size = read(uint16_t);
+            advance_bytes(size);
+            break;
+        }
+        case NBT_Tag_List: {
+            NBT_Tag elements_tag = read(uint8_t);
+            int32_t elements_count = read(int32_t);
+            assert(elements_count >= 0);
+            size_t element_size = fixed_body_size(elements_tag);
+            if (element_size > 0) {
+                advance_bytes(element_size * elements_count);
+                break;
+            }
+            for (int32_t i = 0; i < elements_count; i++)
+                skip_nbt_body(elements_tag, buffer_end, buffer);
+            break;
+        }
+        case NBT_Tag_Compound:
+            while (true) {
+                NBT_Tag child_tag = read(uint8_t);
+                if (child_tag == NBT_Tag_End)
+                    break;
+                uint16_t name_size = read(uint16_t);
+                advance_bytes(name_size);
+                skip_nbt_body(child_tag, buffer_end, buffer);
+            }
+            break;
+        case NBT_Tag_IntArray: {
+            int32_t size = read(int32_t);
+            assert(size >= 0);
+            advance_bytes(sizeof(int32_t) * size);
+            break;
+        }
+        case NBT_Tag_LongArray: {
+            int32_t size = read(int32_t);
+            assert(size >= 0);
+            advance_bytes(sizeof(int64_t) * size);
+            break;
+        }
+    }
+}
+
+static void visit_nbt_value(const DecodeContext* ctx, NBT_Visitor* visitor, NBT_Tag tag, NBT_String name, int32_t index, const char** const buffer) {
+    const char* const buffer_end = ctx->buffer_end;
+    if (visitor->enter && !visitor->enter(visitor, tag, name, index)) {
+        skip_nbt_body(tag, buffer_end, buffer);
+        return;
+    }
+
+    switch (tag) {
+        case NBT_Tag_List: {
+            NBT_Tag elements_tag = read(uint8_t);
+            int32_t elements_count = read(int32_t);
+            assert(elements_count >= 0);
+            if (visitor->list)
+                visitor->list(visitor, elements_tag, elements_count);
+            for (int32_t i = 0; i < elements_count; i++)
+                visit_nbt_value(ctx, visitor, elements_tag, (NBT_String) { 0 }, i, buffer);
+            break;
+        }
+        case NBT_Tag_Compound:
+            while (true) {
+                NBT_Tag child_tag = read(uint8_t);
+                if (child_tag == NBT_Tag_End)
+                    break;
+                NBT_String child_name = decode_string(ctx, buffer);
+                visit_nbt_value(ctx, visitor, child_tag, child_name, -1, buffer);
+            }
+            break;
+        default: {
+            // in view mode, leaves decode without allocating anything
+            NBT_Body body;
+            bool body_ok = cunk_decode_nbt_body(tag, &body, ctx, buffer);
+            assert(body_ok);
+            if (visitor->leaf)
+                visitor->leaf(visitor, tag, &body);
+            return;
+        }
+    }
+
+    if (visitor->leave)
+        visitor->leave(visitor, tag);
+}
+
+static bool visit_nbt_root(const DecodeContext* ctx, NBT_Visitor* visitor, const char** const buffer) {
+    const char* const buffer_end = ctx->buffer_end;
+    NBT_Tag tag = read(uint8_t);
+    if (tag == NBT_Tag_End)
+        return false;
+    NBT_String name = decode_string(ctx, buffer);
+    visit_nbt_value(ctx, visitor, tag, name, -1, buffer);
+    return true;
+}
+
+bool cunk_visit_nbt(size_t buffer_size, const char* buffer, NBT_Visitor* visitor) {
+    if (buffer_size == 0)
+        return false;
+    DecodeContext ctx = {
+        .buffer_start = buffer,
+        .buffer_end = buffer + buffer_size,
+        .mode = NBT_Decode_View,
+    };
+    return visit_nbt_root(&ctx, visitor, &buffer);
+}
+
+bool cunk_nbt_string_equals(NBT_String s, const char* str) {
+    size_t length = strlen(str);
+    return s.length == length && memcmp(s.chars, str, length) == 0;
+}
+
+int32_t cunk_nbt_int_array_get(const NBT_IntArray* a, int32_t i) {
+    assert(i >= 0 && i < a->count);
+    uint32_t value;
+    memcpy(&value, (const char*) a->arr + sizeof(int32_t) * i, sizeof(int32_t));
+    return (int32_t) (a->native_endian ? value : enkl_bswap32(value));
+}
+
+int64_t cunk_nbt_long_array_get(const NBT_LongArray* a, int32_t i) {
+    assert(i >= 0 && i < a->count);
+    uint64_t value;
+    memcpy(&value, (const char*) a->arr + sizeof(int64_t) * i, sizeof(int64_t));
+    return (int64_t) (a->native_endian ? value : enkl_bswap64(value));
+}
+
+void cunk_nbt_int_array_to_native(const NBT_IntArray* a, int32_t* dst) {
+    if (a->native_endian)
+        memcpy(dst, a->arr, sizeof(int32_t) * a->count);
+    else
+        enkl_swap_endianness_32(dst, a->arr, a->count);
+}
+
+void cunk_nbt_long_array_to_native(const NBT_LongArray* a, int64_t* dst) {
+    if (a->native_endian)
+        memcpy(dst, a->arr, sizeof(int64_t) * a->count);
+    else
+        enkl_swap_endianness_64(dst, a->arr, a->count);
+}
+
+NBT_Key cunk_nbt_make_key(const char* name) {
+    size_t length = strlen(name);
+    assert(length <= UINT16_MAX);
+    return (NBT_Key) {
+        .name = name,
+        .length = (uint16_t) length,
+        .hash = hash_name(name, length),
+    };
+}
+
+uint32_t cunk_nbt_hash_string(NBT_String s) {
+    return hash_name(s.chars, s.length);
+}
+
+static bool matches_key(const NBT_Object* o, const NBT_Key* key) {
+    return o->name_hash == key->hash && o->name.length == key->length && memcmp(o->name.chars, key->name, key->length) == 0;
+}
+
+const NBT_Object* cunk_nbt_compound_find(const NBT_Compound* c, const NBT_Key* key) {
+    if (has_compound_index(c)) {
+        const uint16_t* index = get_compound_index(c);
+        size_t mask = compound_index_size(c->count) - 1;
+        for (size_t slot = key->hash & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+            const NBT_Object* child = c->objects[index[slot] - 1];
+            if (matches_key(child, key))
+                return child;
+        }
+        return NULL;
+    }
+
     for (size_t i = 0; i < c->count; i++) {
         const NBT_Object* child = c->objects[i];
-        if (strcmp(child->name, name) == 0)
+        if (matches_key(child, key))
             return child;
     }
     return NULL;
 }
 
+void cunk_nbt_compound_find_many(const NBT_Compound* c, size_t count, const NBT_Key* keys, const NBT_Object** found) {
+    for (size_t k = 0; k < count; k++)
+        found[k] = NULL;
+    if (has_compound_index(c)) {
+        for (size_t k = 0; k < count; k++)
+            found[k] = cunk_nbt_compound_find(c, &keys[k]);
+        return;
+    }
+
+    size_t missing = count;
+    for (size_t i = 0; i < c->count && missing > 0; i++) {
+        const NBT_Object* child = c->objects[i];
+        for (size_t k = 0; k < count; k++) {
+            if (!found[k] && matches_key(child, &keys[k])) {
+                found[k] = child;
+                missing--;
+            }
+        }
+    }
+}
+
+const NBT_Object* cunk_nbt_compound_direct_access(const NBT_Compound* c, const char* name) {
+    assert(name);
+    NBT_Key key = cunk_nbt_make_key(name);
+    return cunk_nbt_compound_find(c, &key);
+}
+
 const NBT_Object* cunk_nbt_compound_access(const NBT_Object* o, const char* name) {
     return cunk_nbt_compound_direct_access(cunk_nbt_extract_compound(o), name);
 }
@@ -40,7 +40,7 @@ static void enkl_print_nbt_body(Enkl_Printer* p, NBT_Tag tag, NBT_Body body) {
             enkl_print(p, "]");
             break;
         case NBT_Tag_String:
-            enkl_print(p, "\"%s\"", body.p_string);
+            enkl_print(p, "\"%.*s\"", (int) body.p_string.length, body.p_string.chars);
             break;
         case NBT_Tag_List:
             enkl_print(p, "(%s[]) [", nbt_tag_name[body.p_list.tag]);
@@ -67,7 +67,7 @@ static void enkl_print_nbt_body(Enkl_Printer* p, NBT_Tag tag, NBT_Body body) {
         case NBT_Tag_IntArray:
             enkl_print(p, "[");
             for (int32_t i = 0; i < body.p_int_array.count; i++) {
-                enkl_print(p, "%d", body.p_int_array.arr[i]);
+                enkl_print(p, "%d", cunk_nbt_int_array_get(&body.p_int_array, i));
                 if (i + 1 < body.p_int_array.count)
                     enkl_print(p, ", ");
             }
@@ -76,7 +76,7 @@ static void enkl_print_nbt_body(Enkl_Printer* p, NBT_Tag tag, NBT_Body body) {
         case NBT_Tag_LongArray:
             enkl_print(p, "[");
             for (int32_t i = 0; i < body.p_long_array.count; i++) {
-                enkl_print(p, "%d", body.p_long_array.arr[i]);
+                enkl_print(p, "%d", cunk_nbt_long_array_get(&body.p_long_array, i));
                 if (i + 1 < body.p_long_array.count)
                     enkl_print(p, ", ");
             }
@@ -86,6 +86,6 @@ static void enkl_print_nbt_body(Enkl_Printer* p, NBT_Tag tag, NBT_Body body) {
 }
 
 void enkl_print_nbt(Enkl_Printer* p, const NBT_Object* o) {
-    enkl_print(p, "%s %s = ", nbt_tag_name[o->tag], o->name);
+    enkl_print(p, "%s %.*s = ", nbt_tag_name[o->tag], (int) o->name.length, o->name.chars);
     enkl_print_nbt_body(p, o->tag, o->body);
 }
@@ -20,8 +20,11 @@ int main(int argc, char** argv) {
         printf("compressed size: %zu\n", buf_size);
         void* decompressed;
         size_t decompressed_size;
-        enkl_inflate(ZLib_GZip, buf_size, buf, &decompressed_size, &decompressed, &allocator);
+        if (!enkl_inflate(ZLib_GZip, buf_size, buf, &decompressed_size, &decompressed, &allocator))
+            return 1;
         free(buf);
+        buf = decompressed;
+        buf_size = decompressed_size;
         printf("Decompression successful\n");
     }
 
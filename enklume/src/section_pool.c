@@ -0,0 +1,184 @@
+#include "section_pool.h"
+
+#include "enklume/block_data.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+/// Free blocks a thread keeps per class, once full half of them go to the shared list
+#define THREAD_CACHE_CAPACITY 16
+/// Free storage the shared lists hold on to per class, anything released past that goes back to the system
+#define SHARED_LIST_MAX_BYTES (16 * 1024 * 1024)
+
+/// Free blocks are linked through their first bytes
+typedef struct FreeBlock_ {
+    struct FreeBlock_* next;
+} FreeBlock;
+
+typedef struct {
+    mtx_t lock;
+    FreeBlock* head;
+    size_t count;
+    size_t block_size;
+} SharedList;
+
+typedef struct {
+    size_t count[ENKL_SECTION_POOL_CLASSES];
+    size_t block_size[ENKL_SECTION_POOL_CLASSES];
+    void* blocks[ENKL_SECTION_POOL_CLASSES][THREAD_CACHE_CAPACITY];
+} ThreadCache;
+
+static SharedList shared_lists[ENKL_SECTION_POOL_CLASSES];
+static tss_t thread_cache_key;
+static once_flag pool_once = ONCE_FLAG_INIT;
+
+static struct {
+    atomic_size_t live_sections, live_bytes, peak_live_bytes;
+    atomic_size_t cached_bytes, peak_cached_bytes;
+    atomic_size_t reused, allocated;
+} stats;
+
+static void add_stat(atomic_size_t* stat, atomic_size_t* peak, size_t amount) {
+    size_t value = atomic_fetch_add_explicit(stat, amount, memory_order_relaxed) + amount;
+    size_t prev = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > prev && !atomic_compare_exchange_weak_explicit(peak, &prev, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+static void sub_stat(atomic_size_t* stat, size_t amount) {
+    atomic_fetch_sub_explicit(stat, amount, memory_order_relaxed);
+}
+
+/// Frees what doesn't fit under SHARED_LIST_MAX_BYTES
+static void give_shared(unsigned size_class, size_t size, void** blocks, size_t count) {
+    SharedList* list = &shared_lists[size_class];
+    size_t max_count = SHARED_LIST_MAX_BYTES / size;
+    mtx_lock(&list->lock);
+    list->block_size = size;
+    size_t i = 0;
+    for (; i < count && list->count < max_count; i++) {
+        FreeBlock* block = blocks[i];
+        block->next = list->head;
+        list->head = block;
+        list->count++;
+    }
+    mtx_unlock(&list->lock);
+    for (; i < count; i++) {
+        free(blocks[i]);
+        sub_stat(&stats.cached_bytes, size);
+    }
+}
+
+static size_t take_shared(unsigned size_class, void** blocks, size_t max) {
+    SharedList* list = &shared_lists[size_class];
+    size_t count = 0;
+    mtx_lock(&list->lock);
+    while (count < max && list->head) {
+        blocks[count++] = list->head;
+        list->head = list->head->next;
+        list->count--;
+    }
+    mtx_unlock(&list->lock);
+    return count;
+}
+
+/// Runs when a thread exits, whatever it cached goes to the shared lists for the others to use
+static void destroy_thread_cache(ThreadCache* cache) {
+    for (unsigned c = 0; c < ENKL_SECTION_POOL_CLASSES; c++)
+        if (cache->count[c] > 0)
+            give_shared(c, cache->block_size[c], cache->blocks[c], cache->count[c]);
+    free(cache);
+}
+
+static void init_pool(void) {
+    for (unsigned c = 0; c < ENKL_SECTION_POOL_CLASSES; c++) {
+        int ret = mtx_init(&shared_lists[c].lock, mtx_plain);
+        assert(ret == thrd_success);
+    }
+    int ret = tss_create(&thread_cache_key, (tss_dtor_t) destroy_thread_cache);
+    assert(ret == thrd_success);
+}
+
+static ThreadCache* get_thread_cache(void) {
+    call_once(&pool_once, init_pool);
+    ThreadCache* cache = tss_get(thread_cache_key);
+    if (!cache) {
+        cache = calloc(1, sizeof(ThreadCache));
+        assert(cache);
+        tss_set(thread_cache_key, cache);
+    }
+    return cache;
+}
+
+void* enkl_section_pool_acquire(unsigned size_class, size_t size) {
+    assert(size_class < ENKL_SECTION_POOL_CLASSES && size >= sizeof(FreeBlock));
+    ThreadCache* cache = get_thread_cache();
+    // what's taken from the shared list goes back there when the thread exits, at this size
+    cache->block_size[size_class] = size;
+    if (cache->count[size_class] == 0)
+        cache->count[size_class] = take_shared(size_class, cache->blocks[size_class], THREAD_CACHE_CAPACITY / 2);
+
+    void* storage;
+    if (cache->count[size_class] > 0) {
+        storage = cache->blocks[size_class][--cache->count[size_class]];
+        sub_stat(&stats.cached_bytes, size);
+        atomic_fetch_add_explicit(&stats.reused, 1, memory_order_relaxed);
+    } else {
+        storage = malloc(size);
+        assert(storage);
+        atomic_fetch_add_explicit(&stats.allocated, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&stats.live_sections, 1, memory_order_relaxed);
+    add_stat(&stats.live_bytes, &stats.peak_live_bytes, size);
+    return storage;
+}
+
+void enkl_section_pool_release(unsigned size_class, size_t size, void* storage) {
+    assert(size_class < ENKL_SECTION_POOL_CLASSES);
+    if (!storage)
+        return;
+    ThreadCache* cache = get_thread_cache();
+    atomic_fetch_sub_explicit(&stats.live_sections, 1, memory_order_relaxed);
+    sub_stat(&stats.live_bytes, size);
+    add_stat(&stats.cached_bytes, &stats.peak_cached_bytes, size);
+
+    cache->block_size[size_class] = size;
+    if (cache->count[size_class] == THREAD_CACHE_CAPACITY) {
+        // keep the other half, so a thread alternating between acquiring and releasing doesn't bounce on the lock
+        give_shared(size_class, size, cache->blocks[size_class] + THREAD_CACHE_CAPACITY / 2, THREAD_CACHE_CAPACITY / 2);
+        cache->count[size_class] = THREAD_CACHE_CAPACITY / 2;
+    }
+    cache->blocks[size_class][cache->count[size_class]++] = storage;
+}
+
+void enkl_get_section_pool_stats(Enkl_SectionPoolStats* out) {
+    *out = (Enkl_SectionPoolStats) {
+        .live_sections = atomic_load_explicit(&stats.live_sections, memory_order_relaxed),
+        .live_bytes = atomic_load_explicit(&stats.live_bytes, memory_order_relaxed),
+        .peak_live_bytes = atomic_load_explicit(&stats.peak_live_bytes, memory_order_relaxed),
+        .cached_bytes = atomic_load_explicit(&stats.cached_bytes, memory_order_relaxed),
+        .peak_cached_bytes = atomic_load_explicit(&stats.peak_cached_bytes, memory_order_relaxed),
+        .reused = atomic_load_explicit(&stats.reused, memory_order_relaxed),
+        .allocated = atomic_load_explicit(&stats.allocated, memory_order_relaxed),
+    };
+}
+
+void enkl_trim_section_pool(void) {
+    call_once(&pool_once, init_pool);
+    for (unsigned c = 0; c < ENKL_SECTION_POOL_CLASSES; c++) {
+        SharedList* list = &shared_lists[c];
+        mtx_lock(&list->lock);
+        FreeBlock* head = list->head;
+        size_t freed = list->count * list->block_size;
+        list->head = NULL;
+        list->count = 0;
+        mtx_unlock(&list->lock);
+        while (head) {
+            FreeBlock* next = head->next;
+            free(head);
+            head = next;
+        }
+        sub_stat(&stats.cached_bytes, freed);
+    }
+}
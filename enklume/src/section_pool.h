@@ -0,0 +1,14 @@
+#ifndef ENKL_SECTION_POOL_H
+#define ENKL_SECTION_POOL_H
+
+#include <stddef.h>
+
+/// One class per section width, every block in a class has the same size
+#define ENKL_SECTION_POOL_CLASSES 6
+
+/// Storage for a section, recycled from the calling thread's cache when there is some. The contents are left as they were.
+void* enkl_section_pool_acquire(unsigned size_class, size_t size);
+/// size_class and size must be the ones the storage was acquired with.
+void enkl_section_pool_release(unsigned size_class, size_t size, void* storage);
+
+#endif
@@ -37,7 +37,7 @@ uint64_t enkl_fetch_bits(const void* buf, size_t bit_pos, unsigned int width) {
 }
 
 uint64_t enkl_fetch_bits_long_arr(const void* buf, bool big_endian, size_t bit_pos, unsigned int width) {
-    const int64_t* lbuf = buf;
+    const char* lbuf = buf;
 #define LONG_BITS (CHAR_BIT * sizeof(int64_t))
     int64_t acc = 0;
 
@@ -47,7 +47,8 @@ uint64_t enkl_fetch_bits_long_arr(const void* buf, bool big_endian, size_t bit_p
         size_t new_pos = (bit_pos + bit) / LONG_BITS;
         if (new_pos != pos) {
             pos = new_pos;
-            last_fetch = lbuf[pos];
+            // the array may point straight into an NBT buffer, so it's not necessarily aligned
+            memcpy(&last_fetch, lbuf + pos * sizeof(int64_t), sizeof(int64_t));
             if (big_endian)
                 last_fetch = enkl_swap_endianness(8, last_fetch);
         }
@@ -107,6 +108,65 @@ bool enkl_read_file(const char* filename, size_t* out_size, char** out_buffer, E
     return false;
 }
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool enkl_map_file(const char* filename, size_t* out_size, const char** out_mapping) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    off_t length = lseek(fd, 0, SEEK_END);
+    if (length <= 0) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, (size_t) length, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    *out_size = (size_t) length;
+    *out_mapping = mapping;
+    return true;
+}
+
+void enkl_unmap_file(const char* mapping, size_t size) {
+    munmap((void*) mapping, size);
+}
+
+void enkl_advise_mapping(const char* mapping, size_t size, size_t offset, size_t length, Enkl_MappingAdvice advice) {
+    if (offset >= size)
+        return;
+    if (offset + length > size)
+        length = size - offset;
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page_size - 1);
+    size_t end = offset + length;
+    int native_advice;
+    switch (advice) {
+        case Enkl_Advice_Normal:   native_advice = MADV_NORMAL; break;
+        case Enkl_Advice_Random:   native_advice = MADV_RANDOM; break;
+        case Enkl_Advice_WillNeed: native_advice = MADV_WILLNEED; break;
+        case Enkl_Advice_DontNeed: native_advice = MADV_DONTNEED; break;
+        default: return;
+    }
+    // purely a hint, failures don't matter
+    madvise((void*) (mapping + start), end - start, native_advice);
+}
+#else
+bool enkl_map_file(const char* filename, size_t* out_size, const char** out_mapping) {
+    return false;
+}
+
+void enkl_unmap_file(const char* mapping, size_t size) {
+    assert(false && "no file mappings on this platform");
+}
+
+void enkl_advise_mapping(const char* mapping, size_t size, size_t offset, size_t length, Enkl_MappingAdvice advice) {}
+#endif
+
 // this does not work on non-POSIX compliant systems
 // Cygwin/MINGW works though.
 #include "sys/stat.h"
@@ -131,17 +191,25 @@ bool enkl_file_exists(const char* filename) {
 }
 
 int64_t enkl_swap_endianness(int bytes, int64_t i) {
-    int64_t acc = 0;
-    for (int byte = 0; byte < bytes; byte++)
-        acc |= ((i >> byte * 8) & 0xFF) << (bytes - 1 - byte) * 8;
-    return acc;
+    switch (bytes) {
+        case 1: return (uint8_t) i;
+        case 2: return enkl_bswap16((uint16_t) i);
+        case 4: return enkl_bswap32((uint32_t) i);
+        case 8: return (int64_t) enkl_bswap64((uint64_t) i);
+        default: {
+            uint64_t acc = 0;
+            for (int byte = 0; byte < bytes; byte++)
+                acc |= (((uint64_t) i >> byte * 8) & 0xFF) << (bytes - 1 - byte) * 8;
+            return (int64_t) acc;
+        }
+    }
 }
 
 enum {
     ThreadLocalStaticBufferSize = 256
 };
 
-static char static_buffer[ThreadLocalStaticBufferSize];
+static _Thread_local char static_buffer[ThreadLocalStaticBufferSize];
 
 static void format_string_internal(const char* str, va_list args, void* uptr, void final_allocator(void*, size_t, char*)) {
     size_t buffer_size = ThreadLocalStaticBufferSize;
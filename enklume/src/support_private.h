@@ -11,6 +11,26 @@ unsigned int enkl_needed_bits(unsigned int n);
 uint64_t enkl_fetch_bits(const void* buf, size_t bit_pos, unsigned int width);
 uint64_t enkl_fetch_bits_long_arr(const void* buf, bool big_endian, size_t bit_pos, unsigned int width);
 int64_t enkl_swap_endianness(int bytes, int64_t i);
+
+/// Unpacks the 4096 palette indices of a section from native-endian longs, or returns false if there aren't enough longs to hold them.
+/// Unless can_straddle is set (pre-20w17a), indices never cross a long and the leftover high bits of each long are padding.
+bool enkl_unpack_section_indices(const uint64_t* longs, size_t longs_count, unsigned int bits, bool can_straddle, uint16_t* indices);
+/// Same without the SIMD kernels, whatever the CPU supports
+bool enkl_unpack_section_indices_scalar(const uint64_t* longs, size_t longs_count, unsigned int bits, bool can_straddle, uint16_t* indices);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define enkl_bswap16(x) __builtin_bswap16(x)
+#define enkl_bswap32(x) __builtin_bswap32(x)
+#define enkl_bswap64(x) __builtin_bswap64(x)
+#else
+static inline uint16_t enkl_bswap16(uint16_t x) { return (uint16_t) (x << 8 | x >> 8); }
+static inline uint32_t enkl_bswap32(uint32_t x) { return (uint32_t) enkl_bswap16(x) << 16 | enkl_bswap16(x >> 16); }
+static inline uint64_t enkl_bswap64(uint64_t x) { return (uint64_t) enkl_bswap32(x) << 32 | enkl_bswap32(x >> 32); }
+#endif
+
+/// Byte-swaps count values from src into dst (which may be the same), neither has to be aligned. Uses SSSE3/AVX2 when the CPU has them.
+void enkl_swap_endianness_32(void* dst, const void* src, size_t count);
+void enkl_swap_endianness_64(void* dst, const void* src, size_t count);
 bool enkl_folder_exists(const char* filename);
 bool enkl_file_exists(const char* filename);
 bool enkl_string_ends_with(const char* string, const char* suffix);
@@ -20,6 +40,16 @@ const char* enkl_replace_string(const char* source, const char* match, const cha
 char* enkl_copy_string(const char*, Enkl_Allocator*);
 bool enkl_read_file(const char* filename, size_t* out_size, char** out_buffer, Enkl_Allocator* allocator);
 
+typedef enum {
+    Enkl_Advice_Normal, Enkl_Advice_Random, Enkl_Advice_WillNeed, Enkl_Advice_DontNeed
+} Enkl_MappingAdvice;
+
+/// Maps a whole file read-only. Returns false if the file can't be mapped (or mapping isn't supported on this platform).
+bool enkl_map_file(const char* filename, size_t* out_size, const char** out_mapping);
+void enkl_unmap_file(const char* mapping, size_t size);
+/// Hints the OS about how [offset, offset + length) of a mapping is going to be used. The range is widened to page boundaries.
+void enkl_advise_mapping(const char* mapping, size_t size, size_t offset, size_t length, Enkl_MappingAdvice);
+
 void* enkl_append_bytes_resize_helper(void* dst, size_t* dst_offset, size_t* dst_capacity, const void* src, size_t size, Enkl_Allocator* allocator);
 
 typedef enum {
@@ -28,4 +58,23 @@ typedef enum {
 
 bool enkl_inflate(ZLibMode, size_t src_size, const void* input_data, size_t* output_size, void** output, Enkl_Allocator* allocator);
 
+/// Keeps a zlib stream and an output arena around so that back-to-back inflates don't reallocate anything.
+typedef struct Enkl_InflateContext_ Enkl_InflateContext;
+
+Enkl_InflateContext* enkl_create_inflate_context(void);
+void enkl_destroy_inflate_context(Enkl_InflateContext*);
+/// Created on first use and destroyed when the thread exits
+Enkl_InflateContext* enkl_get_thread_inflate_context(void);
+/// The output lives in the context's arena and stays valid until the next call.
+bool enkl_inflate_with_context(Enkl_InflateContext*, ZLibMode, size_t src_size, const void* input_data, size_t* output_size, const void** output);
+/// Same, but the output is allocated from the given allocator and belongs to the caller.
+bool enkl_inflate_with_context_into(Enkl_InflateContext*, ZLibMode, size_t src_size, const void* input_data, size_t* output_size, void** output, Enkl_Allocator* allocator);
+/// Makes sure the context's arena holds at least size bytes (its contents are not preserved), for other decoders to write into. NULL if that can't be allocated.
+void* enkl_inflate_context_reserve_output(Enkl_InflateContext*, size_t size);
+
+/// Walks the LZ4 block stream written by lz4-java (compression type 4 in region files) to find out how big it is once decoded.
+bool enkl_lz4_block_stream_size(size_t src_size, const void* input_data, size_t* output_size);
+/// Decodes such a stream, output has to be exactly as big as enkl_lz4_block_stream_size says.
+bool enkl_lz4_block_stream_decode(size_t src_size, const void* input_data, size_t output_size, void* output);
+
 #endif
@@ -0,0 +1,171 @@
+#include "support_private.h"
+
+#include <assert.h>
+#include <threads.h>
+
+#define SECTION_BLOCKS (16 * 16 * 16)
+
+static size_t needed_longs(unsigned bits, bool can_straddle) {
+    if (can_straddle)
+        return (SECTION_BLOCKS * bits + 63) / 64;
+    unsigned per_long = 64 / bits;
+    return (SECTION_BLOCKS + per_long - 1) / per_long;
+}
+
+// Word-at-a-time unpackers with the width baked in, so the shifts and masks are all constants.
+// 'packed' is the 1.16+ layout where indices never cross a long, 'straddling' the older one where they do.
+#define UNPACK_SPECIALIZED_WIDTHS(W) W(4) W(5) W(6) W(7) W(8) W(9) W(10) W(11) W(12) W(13) W(14) W(15)
+
+#define W(BITS) \
+static void unpack_packed_##BITS(const uint64_t* longs, uint16_t* indices) { \
+    enum { per_long = 64 / BITS, full_longs = SECTION_BLOCKS / per_long, tail = SECTION_BLOCKS % per_long }; \
+    const uint64_t mask = (UINT64_C(1) << BITS) - 1; \
+    for (size_t l = 0; l < full_longs; l++) { \
+        uint64_t word = longs[l]; \
+        for (int j = 0; j < per_long; j++) { \
+            *indices++ = (uint16_t) (word & mask); \
+            word >>= BITS; \
+        } \
+    } \
+    /* widths dividing 4096 evenly end on a full long, there's nothing after it to read */ \
+    if (tail) { \
+        uint64_t word = longs[full_longs]; \
+        for (int j = 0; j < tail; j++) { \
+            *indices++ = (uint16_t) (word & mask); \
+            word >>= BITS; \
+        } \
+    } \
+} \
+\
+static void unpack_straddling_##BITS(const uint64_t* longs, uint16_t* indices) { \
+    const uint64_t mask = (UINT64_C(1) << BITS) - 1; \
+    uint64_t word = longs[0]; \
+    unsigned offset = 0; \
+    size_t l = 0; \
+    for (size_t i = 0; i < SECTION_BLOCKS; i++) { \
+        uint64_t value = word >> offset; \
+        offset += BITS; \
+        if (offset >= 64) { \
+            offset -= 64; \
+            /* the top bits of this index are at the bottom of the next long */ \
+            word = ++l < (SECTION_BLOCKS * BITS + 63) / 64 ? longs[l] : 0; \
+            if (offset > 0) \
+                value |= word << (BITS - offset); \
+        } \
+        indices[i] = (uint16_t) (value & mask); \
+    } \
+}
+UNPACK_SPECIALIZED_WIDTHS(W)
+#undef W
+
+typedef void (*UnpackFn)(const uint64_t*, uint16_t*);
+
+static const UnpackFn unpack_packed_fns[16] = {
+#define W(BITS) [BITS] = unpack_packed_##BITS,
+UNPACK_SPECIALIZED_WIDTHS(W)
+#undef W
+};
+
+static const UnpackFn unpack_straddling_fns[16] = {
+#define W(BITS) [BITS] = unpack_straddling_##BITS,
+UNPACK_SPECIALIZED_WIDTHS(W)
+#undef W
+};
+
+/// Any width, for the ones that don't show up in block states
+static void unpack_generic(const uint64_t* longs, size_t longs_count, unsigned bits, bool can_straddle, uint16_t* indices) {
+    const uint64_t mask = bits == 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+    size_t bit_pos = 0;
+    for (size_t i = 0; i < SECTION_BLOCKS; i++) {
+        size_t l = bit_pos / 64;
+        unsigned offset = bit_pos % 64;
+        if (!can_straddle && offset + bits > 64) {
+            l++;
+            offset = 0;
+            bit_pos = l * 64;
+        }
+        uint64_t value = longs[l] >> offset;
+        if (offset + bits > 64 && l + 1 < longs_count)
+            value |= longs[l + 1] << (64 - offset);
+        indices[i] = (uint16_t) (value & mask);
+        bit_pos += bits;
+    }
+}
+
+static void unpack_packed_scalar(const uint64_t* longs, unsigned bits, uint16_t* indices) {
+    unpack_packed_fns[bits](longs, indices);
+}
+
+static void (*unpack_packed_kernel)(const uint64_t*, unsigned, uint16_t*) = unpack_packed_scalar;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+/// Spreads each long over 16 lanes with variable shifts, then narrows them down to 16 bit indices.
+/// Always produces 16 indices per long but only advances by as many as the long holds, so the last few longs go through the scalar path.
+__attribute__((target("avx2")))
+static void unpack_packed_avx2(const uint64_t* longs, unsigned bits, uint16_t* indices) {
+    const unsigned per_long = 64 / bits;
+    const __m256i mask = _mm256_set1_epi64x((int64_t) ((UINT64_C(1) << bits) - 1));
+    __m256i shifts[4];
+    for (int q = 0; q < 4; q++)
+        shifts[q] = _mm256_setr_epi64x((q * 4 + 0) * bits, (q * 4 + 1) * bits, (q * 4 + 2) * bits, (q * 4 + 3) * bits);
+    // after the two packs the 32 bit pairs come out as 0 2 4 6 / 1 3 5 7
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t out = 0, l = 0;
+    for (; out + 16 <= SECTION_BLOCKS; l++, out += per_long) {
+        __m256i word = _mm256_set1_epi64x((int64_t) longs[l]);
+        __m256i s0 = _mm256_and_si256(_mm256_srlv_epi64(word, shifts[0]), mask);
+        __m256i s1 = _mm256_and_si256(_mm256_srlv_epi64(word, shifts[1]), mask);
+        __m256i s2 = _mm256_and_si256(_mm256_srlv_epi64(word, shifts[2]), mask);
+        __m256i s3 = _mm256_and_si256(_mm256_srlv_epi64(word, shifts[3]), mask);
+        __m256i p01 = _mm256_packus_epi32(s0, s1);
+        __m256i p23 = _mm256_packus_epi32(s2, s3);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi32(p01, p23), order);
+        _mm256_storeu_si256((__m256i*) (indices + out), packed);
+    }
+
+    const uint64_t scalar_mask = (UINT64_C(1) << bits) - 1;
+    for (; out < SECTION_BLOCKS; l++) {
+        uint64_t word = longs[l];
+        for (unsigned j = 0; j < per_long && out < SECTION_BLOCKS; j++) {
+            indices[out++] = (uint16_t) (word & scalar_mask);
+            word >>= bits;
+        }
+    }
+}
+
+static void select_kernels(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        unpack_packed_kernel = unpack_packed_avx2;
+}
+#else
+static void select_kernels(void) {}
+#endif
+
+static once_flag kernels_once = ONCE_FLAG_INIT;
+
+static bool unpack_section_indices(const uint64_t* longs, size_t longs_count, unsigned bits, bool can_straddle, uint16_t* indices, void (*packed_kernel)(const uint64_t*, unsigned, uint16_t*)) {
+    assert(bits > 0 && bits <= 16);
+    if (longs_count < needed_longs(bits, can_straddle))
+        return false;
+
+    if (bits < 4 || bits > 15)
+        unpack_generic(longs, longs_count, bits, can_straddle, indices);
+    else if (can_straddle)
+        unpack_straddling_fns[bits](longs, indices);
+    else
+        packed_kernel(longs, bits, indices);
+    return true;
+}
+
+bool enkl_unpack_section_indices(const uint64_t* longs, size_t longs_count, unsigned bits, bool can_straddle, uint16_t* indices) {
+    call_once(&kernels_once, select_kernels);
+    return unpack_section_indices(longs, longs_count, bits, can_straddle, indices, unpack_packed_kernel);
+}
+
+bool enkl_unpack_section_indices_scalar(const uint64_t* longs, size_t longs_count, unsigned bits, bool can_straddle, uint16_t* indices) {
+    return unpack_section_indices(longs, longs_count, bits, can_straddle, indices, unpack_packed_scalar);
+}
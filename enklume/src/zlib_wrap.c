@@ -2,8 +2,14 @@
 #include "zlib.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <threads.h>
 
 #define ZLIB_CHUNK_SIZE 4096
+/// deflate can't do better than about 1032:1, a gzip trailer claiming more is corrupt
+#define ZLIB_MAX_RATIO 1032
 
 /* report a zlib or i/o error */
 void zerr(int ret) {
@@ -39,39 +45,153 @@ static int format_bits(ZLibMode mode) {
     }
 }
 
+/// Room to reserve when we have no idea how big the output is, NBT tends to compress about 4:1
+static size_t guess_output_size(ZLibMode mode, size_t src_size, const void* input_data) {
+    // gzip streams end with the uncompressed size (mod 2^32), which is good enough for sizing the output exactly
+    if (mode == ZLib_GZip && src_size >= 18) {
+        const uint8_t* trailer = (const uint8_t*) input_data + src_size - 4;
+        size_t isize = (size_t) trailer[0] | (size_t) trailer[1] << 8 | (size_t) trailer[2] << 16 | (size_t) trailer[3] << 24;
+        if (isize > 0 && isize <= src_size * ZLIB_MAX_RATIO)
+            return isize;
+    }
+    size_t guess = src_size * 4;
+    return guess < ZLIB_CHUNK_SIZE ? ZLIB_CHUNK_SIZE : guess;
+}
+
+/// Inflates straight into *buffer, growing it as needed. With enough room this is a single inflate() call.
+static bool inflate_into(z_stream* strm, size_t src_size, const void* input_data, uint8_t** buffer, size_t* capacity, size_t* output_size, Enkl_Allocator* allocator) {
+    strm->next_in = (unsigned char*) input_data;
+    strm->avail_in = src_size;
+    size_t size = 0;
+    while (true) {
+        if (size == *capacity) {
+            size_t new_capacity = *capacity * 2;
+            *buffer = allocator->grow_allocation(allocator, *buffer, 1, *capacity, new_capacity);
+            assert(*buffer);
+            *capacity = new_capacity;
+        }
+        size_t room = *capacity - size;
+        if (room > UINT_MAX)
+            room = UINT_MAX;
+        strm->next_out = *buffer + size;
+        strm->avail_out = room;
+        int ret = inflate(strm, Z_FINISH);
+        size = strm->next_out - *buffer;
+        if (ret == Z_STREAM_END)
+            break;
+        // Z_BUF_ERROR just means we ran out of output space, unless there was space left
+        if (ret == Z_OK || (ret == Z_BUF_ERROR && strm->avail_out == 0))
+            continue;
+        zerr(ret);
+        return false;
+    }
+    *output_size = size;
+    return true;
+}
+
 bool enkl_inflate(ZLibMode mode, size_t src_size, const void* input_data, size_t* output_size, void** output, Enkl_Allocator* allocator) {
-    size_t space = 4096, size = 0;
-    *output = allocator->allocate_bytes(allocator, space, 0);
+    size_t capacity = guess_output_size(mode, src_size, input_data);
+    uint8_t* buffer = allocator->allocate_bytes(allocator, capacity, 1);
 
-    int ret;
+    z_stream strm = { 0 };
+    if (inflateInit2(&strm, format_bits(mode)) != Z_OK) {
+        allocator->free_bytes(allocator, buffer);
+        return false;
+    }
+
+    bool ok = inflate_into(&strm, src_size, input_data, &buffer, &capacity, output_size, allocator);
+    inflateEnd(&strm);
+    if (!ok) {
+        allocator->free_bytes(allocator, buffer);
+        return false;
+    }
+    *output = buffer;
+    return true;
+}
+
+struct Enkl_InflateContext_ {
     z_stream strm;
-    unsigned char out[ZLIB_CHUNK_SIZE];
-
-    /* allocate inflate state */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = 0;
-    strm.next_in = Z_NULL;
-    ret = inflateInit2(&strm, format_bits(mode));
-    if (ret != Z_OK)
+    bool initialized;
+    Enkl_Allocator allocator;
+    /// output arena, reused from one call to the next
+    uint8_t* arena;
+    size_t arena_capacity;
+};
+
+Enkl_InflateContext* enkl_create_inflate_context(void) {
+    Enkl_InflateContext* ctx = calloc(1, sizeof(Enkl_InflateContext));
+    ctx->allocator = enkl_get_malloc_free_allocator();
+    return ctx;
+}
+
+void enkl_destroy_inflate_context(Enkl_InflateContext* ctx) {
+    if (ctx->initialized)
+        inflateEnd(&ctx->strm);
+    free(ctx->arena);
+    free(ctx);
+}
+
+static tss_t thread_context_key;
+static once_flag thread_context_key_once = ONCE_FLAG_INIT;
+
+static void create_thread_context_key(void) {
+    int ret = tss_create(&thread_context_key, (tss_dtor_t) enkl_destroy_inflate_context);
+    assert(ret == thrd_success);
+}
+
+Enkl_InflateContext* enkl_get_thread_inflate_context(void) {
+    call_once(&thread_context_key_once, create_thread_context_key);
+    Enkl_InflateContext* ctx = tss_get(thread_context_key);
+    if (!ctx) {
+        ctx = enkl_create_inflate_context();
+        tss_set(thread_context_key, ctx);
+    }
+    return ctx;
+}
+
+void* enkl_inflate_context_reserve_output(Enkl_InflateContext* ctx, size_t size) {
+    if (ctx->arena_capacity < size) {
+        free(ctx->arena);
+        ctx->arena = malloc(size);
+        ctx->arena_capacity = ctx->arena ? size : 0;
+    }
+    return ctx->arena;
+}
+
+static bool reset_context_stream(Enkl_InflateContext* ctx, ZLibMode mode) {
+    int window_bits = format_bits(mode);
+    if (!ctx->initialized) {
+        if (inflateInit2(&ctx->strm, window_bits) != Z_OK)
+            return false;
+        ctx->initialized = true;
+        return true;
+    }
+    return inflateReset2(&ctx->strm, window_bits) == Z_OK;
+}
+
+bool enkl_inflate_with_context(Enkl_InflateContext* ctx, ZLibMode mode, size_t src_size, const void* input_data, size_t* output_size, const void** output) {
+    if (!reset_context_stream(ctx, mode))
         return false;
 
-    strm.avail_in = src_size;
-    strm.next_in = (unsigned char*) input_data;
-    do {
-        strm.avail_out = ZLIB_CHUNK_SIZE;
-        strm.next_out = out;
-        ret = inflate(&strm, Z_NO_FLUSH);
-        size_t got = ZLIB_CHUNK_SIZE - strm.avail_out;
-        *output = enkl_append_bytes_resize_helper(*output, &size, &space, out, got, allocator);
-        if (ret == Z_STREAM_END)
-            break;
-        if (ret)
-            zerr(ret);
-    } while (true);
+    if (!enkl_inflate_context_reserve_output(ctx, guess_output_size(mode, src_size, input_data)))
+        return false;
 
-    inflateEnd(&strm);
-    *output_size = size;
+    if (!inflate_into(&ctx->strm, src_size, input_data, &ctx->arena, &ctx->arena_capacity, output_size, &ctx->allocator))
+        return false;
+    *output = ctx->arena;
+    return true;
+}
+
+bool enkl_inflate_with_context_into(Enkl_InflateContext* ctx, ZLibMode mode, size_t src_size, const void* input_data, size_t* output_size, void** output, Enkl_Allocator* allocator) {
+    if (!reset_context_stream(ctx, mode))
+        return false;
+
+    size_t capacity = guess_output_size(mode, src_size, input_data);
+    uint8_t* buffer = allocator->allocate_bytes(allocator, capacity, 1);
+    if (!inflate_into(&ctx->strm, src_size, input_data, &buffer, &capacity, output_size, allocator)) {
+        allocator->free_bytes(allocator, buffer);
+        return false;
+    }
+    *output = buffer;
     return true;
 }
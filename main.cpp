@@ -15,6 +15,7 @@ struct {
     mat4 matrix;
     ivec3 chunk_position;
     float time;
+    VkDeviceAddress block_colors;
 } push_constants;
 
 Camera camera;
@@ -27,6 +28,8 @@ CameraInput camera_input;
 void camera_update(GLFWwindow*, CameraInput* input);
 
 bool reload_shaders = false;
+bool greedy_meshing = false;
+bool remesh = false;
 
 struct Shaders {
     std::vector<std::string> files = { "basic.vert.spv", "basic.frag.spv" };
@@ -61,21 +64,9 @@ struct Shaders {
             {
                 .location = 0,
                 .binding = 0,
-                .format = VK_FORMAT_R16G16B16_SINT,
+                .format = VK_FORMAT_R32G32_UINT,
                 .offset = 0,
             },
-            {
-                .location = 1,
-                .binding = 0,
-                .format = VK_FORMAT_R8G8B8_SNORM,
-                .offset = offsetof(ChunkMesh::Vertex, nnx),
-            },
-            {
-                .location = 2,
-                .binding = 0,
-                .format = VK_FORMAT_R8G8B8_UNORM,
-                .offset = offsetof(ChunkMesh::Vertex, br),
-            },
         };
 
         VkPipelineVertexInputStateCreateInfo vertex_input {
@@ -133,6 +124,10 @@ int main(int argc, char** argv) {
     glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
         if (key == GLFW_KEY_R && (mods & GLFW_MOD_CONTROL))
             reload_shaders = true;
+        if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+            greedy_meshing = !greedy_meshing;
+            remesh = true;
+        }
     });
 
     imr::Context context;
@@ -151,8 +146,15 @@ int main(int argc, char** argv) {
     std::unique_ptr<imr::Image> depthBuffer;
 
     auto shaders = std::make_unique<Shaders>(device, swapchain);
+    auto quad_indices = ChunkMesh::create_quad_index_buffer(device);
+    auto block_colors_buffer = ChunkMesh::create_block_colors_buffer(device);
 
     auto& vk = device.dispatch;
+    push_constants.block_colors = vk.getBufferDeviceAddress(tmpPtr((VkBufferDeviceAddressInfo) {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = block_colors_buffer->handle,
+    }));
+
     while (!glfwWindowShouldClose(window)) {
         fps_counter.tick();
         fps_counter.updateGlfwWindowTitle(window);
@@ -228,6 +230,7 @@ int main(int argc, char** argv) {
 
             auto& pipeline = shaders->pipeline;
             vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline());
+            vkCmdBindIndexBuffer(cmdbuf, quad_indices->handle, 0, VK_INDEX_TYPE_UINT16);
 
             push_constants.time = ((imr_get_time_nano() / 1000) % 10000000000) / 1000000.0f;
 
@@ -243,31 +246,83 @@ int main(int argc, char** argv) {
 
                 push_constants.matrix = m;
 
-                auto load_chunk = [&](int cx, int cz) {
+                // meshes still in flight are freed once the frame is done with them
+                auto retire_mesh = [&](std::unique_ptr<ChunkMesh>& mesh) {
+                    if (ChunkMesh* released = mesh.release())
+                        context.frame().addCleanupAction([=]() {
+                            delete released;
+                        });
+                };
+                auto retire_meshes = [&](Chunk* chunk) {
+                    for (auto& mesh : chunk->meshes)
+                        retire_mesh(mesh);
+                    if (chunk->meshing) {
+                        chunk->meshing->cancelled = true;
+                        chunk->meshing.reset();
+                    }
+                    chunk->meshed = false;
+                };
+
+                if (remesh) {
+                    for (auto chunk : world.loaded_chunks())
+                        retire_meshes(chunk);
+                    remesh = false;
+                }
+
+                // loading and meshing happen in the background, all that's left here is uploading what's done
+                world.collect_loaded_chunks();
+                world.collect_meshes([&](MeshedChunk& meshed) {
+                    if (meshed.ticket->cancelled)
+                        return;
+                    Chunk* chunk = &*meshed.chunk;
+                    for (int section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++) {
+                        if (!(meshed.sections >> section & 1))
+                            continue;
+                        retire_mesh(chunk->meshes[section]);
+                        if (meshed.geometry[section].num_verts > 0)
+                            chunk->meshes[section] = std::make_unique<ChunkMesh>(device, meshed.geometry[section]);
+                    }
+                    chunk->meshing.reset();
+                    chunk->meshed = true;
+                });
+
+                // the chunk on each side, in BlockFace order
+                static const int sides[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+                auto load_chunk = [&](int cx, int cz, float priority) {
                     auto loaded = world.get_loaded_chunk(cx, cz);
-                    if (!loaded)
-                        world.load_chunk(cx, cz);
-                    else {
-                        if (loaded->mesh)
-                            return;
-
-                        bool all_neighbours_loaded = true;
-                        ChunkNeighbors n = {};
-                        for (int dx = -1; dx < 2; dx++) {
-                            for (int dz = -1; dz < 2; dz++) {
-                                int nx = cx + dx;
-                                int nz = cz + dz;
-
-                                auto neighborChunk = world.get_loaded_chunk(nx, nz);
-                                if (neighborChunk)
-                                    n.neighbours[dx + 1][dz + 1] = &neighborChunk->data;
-                                else
-                                    all_neighbours_loaded = false;
-                            }
+                    if (!loaded) {
+                        if (world.chunk_exists(cx, cz))
+                            world.request_chunk(cx, cz, priority);
+                        return;
+                    }
+
+                    // changes along a border, a chunk arriving included, show on the chunk on that side
+                    for (int side = 0; side < 4; side++) {
+                        uint32_t& border = loaded->data.dirty_borders[side];
+                        if (!border)
+                            continue;
+                        if (auto neighbour = world.get_loaded_chunk(cx + sides[side][0], cz + sides[side][1]))
+                            neighbour->data.dirty_sections |= border;
+                        border = 0;
+                    }
+
+                    // one job per chunk at a time, whatever changes meanwhile goes to the next one
+                    if (loaded->meshing || (loaded->meshed && !loaded->data.dirty_sections))
+                        return;
+
+                    for (int dx = -1; dx < 2; dx++) {
+                        for (int dz = -1; dz < 2; dz++) {
+                            int nx = cx + dx;
+                            int nz = cz + dz;
+                            if (!world.get_loaded_chunk(nx, nz) && world.chunk_exists(nx, nz))
+                                return;
                         }
-                        if (all_neighbours_loaded)
-                            loaded->mesh = std::make_unique<ChunkMesh>(device, n);
                     }
+
+                    uint32_t sections = loaded->meshed ? loaded->data.dirty_sections : (1u << (CUNK_CHUNK_SECTIONS_COUNT)) - 1;
+                    loaded->data.dirty_sections = 0;
+                    world.request_mesh(loaded, sections, greedy_meshing, priority);
                 };
 
                 int player_chunk_x = camera.position.x / 16;
@@ -276,34 +331,34 @@ int main(int argc, char** argv) {
                 int radius = 24;
                 for (int dx = -radius; dx <= radius; dx++) {
                     for (int dz = -radius; dz <= radius; dz++) {
-                        load_chunk(player_chunk_x + dx, player_chunk_z + dz);
+                        load_chunk(player_chunk_x + dx, player_chunk_z + dz, dx * dx + dz * dz);
                     }
                 }
+                world.cancel_requests([&](int cx, int cz) {
+                    return abs(cx - player_chunk_x) <= radius && abs(cz - player_chunk_z) <= radius;
+                });
 
                 for (auto chunk : world.loaded_chunks()) {
                     if (abs(chunk->cx - player_chunk_x) > radius || abs(chunk->cz - player_chunk_z) > radius) {
-                        std::unique_ptr<ChunkMesh> stolen = std::move(chunk->mesh);
-                        if (stolen) {
-                            ChunkMesh* released = stolen.release();
-                            context.frame().addCleanupAction([=]() {
-                                delete released;
-                            });
-                        }
+                        retire_meshes(chunk);
                         world.unload_chunk(chunk);
                         continue;
                     }
 
-                    auto& mesh = chunk->mesh;
-                    if (!mesh || mesh->num_verts == 0)
-                        continue;
-
-                    push_constants.chunk_position = { chunk->cx, 0, chunk->cz };
+                    // meshes count y from the bottom of the chunk data, which is below the world's y = 0
+                    push_constants.chunk_position = { chunk->cx, CUNK_CHUNK_MIN_SECTION, chunk->cz };
                     vkCmdPushConstants(cmdbuf, pipeline->layout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push_constants), &push_constants);
 
-                    vkCmdBindVertexBuffers(cmdbuf, 0, 1, &mesh->buf->handle, tmpPtr((VkDeviceSize) 0));
+                    for (auto& mesh : chunk->meshes) {
+                        if (!mesh)
+                            continue;
+
+                        vkCmdBindVertexBuffers(cmdbuf, 0, 1, &mesh->buf->handle, tmpPtr((VkDeviceSize) 0));
 
-                    assert(mesh->num_verts > 0);
-                    vkCmdDraw(cmdbuf, mesh->num_verts, 1, 0, 0);
+                        size_t num_quads = mesh->num_verts / 4;
+                        assert(num_quads > 0 && num_quads <= ChunkMesh::max_quads_per_draw);
+                        vkCmdDrawIndexed(cmdbuf, num_quads * 6, 1, 0, 0, 0);
+                    }
                 }
             });
 
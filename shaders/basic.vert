@@ -9,25 +9,34 @@ out vec3 color;
 layout(location = 1)
 out vec3 normal;
 
+// see ChunkMesh::Vertex
 layout(location = 0)
-in ivec3 vertexIn;
+in uvec2 vertexIn;
 
-layout(location = 1)
-in vec3 normalIn;
-
-layout(location = 2)
-in vec3 colorIn;
+layout(buffer_reference, scalar) readonly buffer BlockColors {
+    vec3 colors[];
+};
 
 layout(scalar, push_constant) uniform T {
     mat4 matrix;
     ivec3 chunk_position;
     float time;
+    BlockColors block_colors;
 } push_constants;
 
+// in BlockFace order
+const vec3 face_normals[6] = vec3[](
+    vec3(-1, 0, 0), vec3(1, 0, 0),
+    vec3(0, 0, -1), vec3(0, 0, 1),
+    vec3(0, -1, 0), vec3(0, 1, 0)
+);
+
 void main() {
     mat4 matrix = push_constants.matrix;
-    gl_Position = matrix * vec4(vec3(vertexIn + push_constants.chunk_position * 16), 1.0);
-    int primid = gl_VertexIndex / 6;
-    color = colorIn;
-    normal = normalIn;
-}
\ No newline at end of file
+    uint packed = vertexIn.x;
+    ivec3 position = ivec3(packed & 31u, (packed >> 5) & 511u, (packed >> 14) & 31u);
+    gl_Position = matrix * vec4(vec3(position + push_constants.chunk_position * 16), 1.0);
+    int primid = gl_VertexIndex / 4;
+    color = push_constants.block_colors.colors[vertexIn.y];
+    normal = face_normals[(packed >> 19) & 7u];
+}
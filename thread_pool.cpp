@@ -0,0 +1,102 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+/// The pool whose worker runs on this thread, and which one it is
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    // the caller helps out in finish_jobs, but background jobs need at least one worker
+    unsigned count = std::max(threads, 2u) - 1;
+    for (unsigned i = 0; i < count; i++)
+        job_queues.push_back(std::make_unique<JobQueue>());
+    for (unsigned i = 0; i < count; i++)
+        workers.emplace_back([this, i]() { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::worker_loop(unsigned index) {
+    current_pool = this;
+    current_worker = index;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [&]() { return quit || queued_jobs > 0; });
+            if (quit)
+                return;
+        }
+        Job job;
+        if (take_job(index, job))
+            run_job(job);
+    }
+}
+
+bool ThreadPool::runs_later(const Job& a, const Job& b) {
+    return b.priority < a.priority || (b.priority == a.priority && b.order < a.order);
+}
+
+void ThreadPool::submit(std::function<void()> run, float priority) {
+    uint64_t order = submitted.fetch_add(1);
+    unsigned queue_index = current_pool == this ? current_worker : order % job_queues.size();
+
+    unfinished_jobs++;
+    {
+        JobQueue& queue = *job_queues[queue_index];
+        std::lock_guard lock(queue.mutex);
+        queue.jobs.push_back({ std::move(run), priority, order });
+        std::push_heap(queue.jobs.begin(), queue.jobs.end(), runs_later);
+        queued_jobs++;
+    }
+    {
+        // a worker checking queued_jobs does so holding the mutex, taking it here means it either saw the job or is waiting already
+        std::lock_guard lock(mutex);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::take_job(unsigned first_queue, Job& job) {
+    for (size_t i = 0; i < job_queues.size(); i++) {
+        JobQueue& queue = *job_queues[(first_queue + i) % job_queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.jobs.empty())
+            continue;
+        std::pop_heap(queue.jobs.begin(), queue.jobs.end(), runs_later);
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+        queued_jobs--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run_job(Job& job) {
+    job.run();
+    job.run = nullptr;
+    if (--unfinished_jobs == 0) {
+        std::lock_guard lock(mutex);
+        done.notify_all();
+    }
+}
+
+void ThreadPool::finish_jobs() {
+    while (unfinished_jobs > 0) {
+        Job job;
+        if (take_job(0, job)) {
+            run_job(job);
+            continue;
+        }
+        // what's left is running on the workers
+        std::unique_lock lock(mutex);
+        done.wait(lock, [&]() { return unfinished_jobs == 0 || queued_jobs > 0; });
+    }
+}
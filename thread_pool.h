@@ -0,0 +1,98 @@
+#ifndef SIGCRAFT_THREAD_POOL_H
+#define SIGCRAFT_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Hands results from any number of threads to a single consumer without locking: producers push onto an atomic list, the consumer takes all of it at once.
+template <typename T>
+struct ResultQueue {
+    ResultQueue() = default;
+    ResultQueue(const ResultQueue&) = delete;
+    ~ResultQueue() {
+        drain([](T&&) {});
+    }
+
+    void push(T value) {
+        Node* node = new Node { std::move(value), head.load(std::memory_order_relaxed) };
+        while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /// Consumer only, calls f on everything pushed so far, oldest first
+    template <typename F>
+    void drain(F&& f) {
+        Node* list = head.exchange(nullptr, std::memory_order_acquire);
+        Node* oldest = nullptr;
+        while (list) {
+            Node* next = list->next;
+            list->next = oldest;
+            oldest = list;
+            list = next;
+        }
+        while (oldest) {
+            Node* next = oldest->next;
+            f(std::move(oldest->value));
+            delete oldest;
+            oldest = next;
+        }
+    }
+
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> head = nullptr;
+};
+
+/// A fixed set of workers running background jobs
+struct ThreadPool {
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    /// Queues a job to run in the background, the ones with the lowest priority first.
+    /// Every worker has a queue of its own and steals from the others once it's empty: jobs submitted by workers stay on their queue, the others are spread around.
+    void submit(std::function<void()> job, float priority);
+    /// Runs jobs alongside the workers until none are left, including the ones they submit meanwhile
+    void finish_jobs();
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    struct Job {
+        std::function<void()> run;
+        float priority;
+        uint64_t order;
+    };
+
+    /// Orders the job queues' heaps: the one on top, which std::push_heap takes for the largest, runs first
+    static bool runs_later(const Job& a, const Job& b);
+
+    /// A heap, the next job to run on top
+    struct JobQueue {
+        std::mutex mutex;
+        std::vector<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<JobQueue>> job_queues;
+    std::atomic<uint64_t> submitted = 0;
+    /// Jobs sitting in a queue, and the ones that didn't finish running yet
+    std::atomic<size_t> queued_jobs = 0, unfinished_jobs = 0;
+
+    bool quit = false;
+
+    void worker_loop(unsigned index);
+    bool take_job(unsigned first_queue, Job& job);
+    void run_job(Job& job);
+};
+
+#endif
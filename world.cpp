@@ -6,6 +6,15 @@ World::World(const char* filename) {
 }
 
 World::~World() {
+    // background jobs hold on to regions and chunks, let them wrap up (cancelled, so they don't do the work) before any of it goes away
+    for (auto& [_, ticket] : loading)
+        ticket->cancelled = true;
+    for (auto chunk : loaded_chunks())
+        if (chunk->meshing)
+            chunk->meshing->cancelled = true;
+    pool.finish_jobs();
+    collect_loaded_chunks();
+    collect_meshes([](MeshedChunk&) {});
     regions.clear();
     cunk_close_mcworld(enkl_world);
 }
@@ -58,21 +67,106 @@ Chunk* World::get_loaded_chunk(int cx, int cz) {
     return nullptr;
 }
 
-Chunk* World::load_chunk(int cx, int cz) {
+const McRegionIndex& World::get_region_index(int rx, int rz) {
+    if (auto found = region_indices.find({ rx, rz }); found != region_indices.end())
+        return found->second;
+    if (region_indices.size() >= max_region_indices)
+        std::erase_if(region_indices, [&](auto& entry) { return !regions.contains(entry.first); });
+    auto& index = region_indices[{ rx, rz }];
+    // missing regions just get an empty index
+    if (!cunk_scan_mcregion_index(enkl_world, rx, rz, &index))
+        index = {};
+    return index;
+}
+
+bool World::chunk_exists(int cx, int cz) {
     auto [rx, rz] = to_region_coordinates(cx, cz);
-    Region* r = get_loaded_region(rx, rz);
-    if (!r)
-        r = load_region(rx, rz);
-    return r->load_chunk(cx, cz);
+    return cunk_mcregion_index_has_chunk(&get_region_index(rx, rz), cx & 0x1f, cz & 0x1f);
 }
 
 void World::unload_chunk(Chunk* chunk) {
     Region* region = &chunk->region;
+    if (chunk->meshing)
+        chunk->meshing->cancelled = true;
     region->unload_chunk(chunk);
-    if (region->chunks.size() == 0)
+    if (region->chunks.size() == 0 && region->pending_loads == 0)
         unload_region(region);
 }
 
+void World::request_chunk(int cx, int cz, float priority) {
+    if (get_loaded_chunk(cx, cz) || loading.contains({ cx, cz }))
+        return;
+    auto [rx, rz] = to_region_coordinates(cx, cz);
+    Region* region = get_loaded_region(rx, rz);
+    if (!region)
+        region = load_region(rx, rz);
+    region->pending_loads++;
+
+    auto ticket = std::make_shared<JobTicket>();
+    loading[{ cx, cz }] = ticket;
+    pool.submit([this, ticket, region, cx, cz]() {
+        std::shared_ptr<Chunk> chunk;
+        if (!ticket->cancelled)
+            chunk = std::make_shared<Chunk>(*region, cx, cz);
+        loaded_queue.push({ ticket, region, cx, cz, std::move(chunk) });
+    }, priority);
+}
+
+void World::cancel_requests(const std::function<bool(int, int)>& keep) {
+    // the entries stay until the jobs are collected: a job may be past its check already, and a second one for the same chunk would race it
+    for (auto& [position, ticket] : loading)
+        if (!keep(position.x, position.z))
+            ticket->cancelled = true;
+}
+
+void World::collect_loaded_chunks() {
+    loaded_queue.drain([&](LoadedChunk&& loaded) {
+        Region* region = loaded.region;
+        region->pending_loads--;
+        loading.erase({ loaded.cx, loaded.cz });
+        if (!loaded.ticket->cancelled) {
+            Int2 pos = { loaded.cx & 0x1f, loaded.cz & 0x1f };
+            assert(!region->get_chunk(pos.x, pos.z));
+            region->chunks[pos] = std::move(loaded.chunk);
+        }
+        if (region->chunks.size() == 0 && region->pending_loads == 0)
+            unload_region(region);
+    });
+}
+
+void World::request_mesh(Chunk* chunk, uint32_t sections, bool greedy, float priority) {
+    assert(!chunk->meshing);
+    auto result = std::make_shared<MeshedChunk>();
+    result->chunk = chunk->shared_from_this();
+    result->ticket = chunk->meshing = std::make_shared<JobTicket>();
+    result->sections = sections;
+    for (int dx = -1; dx < 2; dx++)
+        for (int dz = -1; dz < 2; dz++)
+            if (auto neighbour = get_loaded_chunk(chunk->cx + dx, chunk->cz + dz))
+                result->neighbours[dx + 1][dz + 1] = neighbour->shared_from_this();
+
+    pool.submit([this, result, greedy]() mutable {
+        if (!result->ticket->cancelled) {
+            ChunkNeighbors n = {};
+            for (int dx = 0; dx < 3; dx++)
+                for (int dz = 0; dz < 3; dz++)
+                    if (result->neighbours[dx][dz])
+                        n.neighbours[dx][dz] = &result->neighbours[dx][dz]->data;
+            for (int section = 0; section < CUNK_CHUNK_SECTIONS_COUNT; section++)
+                if (result->sections >> section & 1)
+                    result->geometry[section] = ChunkMesh::mesh_section(n, section, greedy);
+        }
+        // the chunks should only ever be freed from the render thread, so none of them stays behind in the job
+        meshed_queue.push(std::move(result));
+    }, priority);
+}
+
+void World::collect_meshes(const std::function<void(MeshedChunk&)>& f) {
+    meshed_queue.drain([&](std::shared_ptr<MeshedChunk>&& meshed) {
+        f(*meshed);
+    });
+}
+
 void World::unload_region(Region* region) {
     assert(region->loaded);
     assert(!region->unloaded);
@@ -81,6 +175,7 @@ void World::unload_region(Region* region) {
     int rz = region->rz;
     Int2 pos = {rx, rz};
     regions.erase(pos);
+    region_indices.erase(pos);
 }
 
 Region::Region(World& w, int rx, int rz) : world(w), rx(rx), rz(rz) {
@@ -104,16 +199,6 @@ Chunk* Region::get_chunk(unsigned int rcx, unsigned int rcz) {
     return nullptr;
 }
 
-Chunk* Region::load_chunk(int cx, int cz) {
-    unsigned rcx = cx & 0x1f;
-    unsigned rcz = cz & 0x1f;
-    assert(rcx < 32 && rcz < 32);
-    assert(!get_chunk(rcx, rcz));
-    Int2 pos = {(int)rcx, (int)rcz};
-    auto& r = chunks[pos] = std::make_unique<Chunk>(*this, cx, cz);
-    return &*r;
-}
-
 void Region::unload_chunk(Chunk* chunk) {
     unsigned rcx = chunk->cx & 0x1f;
     unsigned rcz = chunk->cz & 0x1f;
@@ -122,20 +207,13 @@ void Region::unload_chunk(Chunk* chunk) {
 }
 
 Chunk::Chunk(Region& r, int cx, int cz) : region(r), cx(cx), cz(cz) {
-    unsigned rcx = cx & 0x1f;
-    unsigned rcz = cz & 0x1f;
     //printf("! %d %d\n", cx, cz);
-    if (r.enkl_region) {
-        enkl_chunk = cunk_open_mcchunk(r.enkl_region, rcx, rcz);
-        if (enkl_chunk) {
-            load_from_mcchunk(&data, enkl_chunk);
-        }
-    }
+    // only the block data is needed, so stream it out instead of building the whole NBT tree
+    if (region.enkl_region)
+        load_from_mcregion(&data, region.enkl_region, cx & 0x1f, cz & 0x1f);
 }
 
 Chunk::~Chunk() {
     //printf("~ %d %d\n", cx, cz);
     enkl_destroy_chunk_data(&data);
-    if (enkl_chunk)
-        enkl_close_chunk(enkl_chunk);
 }
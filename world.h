@@ -9,6 +9,7 @@ extern "C" {
 }
 
 #include "chunk_mesh.h"
+#include "thread_pool.h"
 
 struct Int2 {
     int32_t x, z;
@@ -30,12 +31,22 @@ struct std::hash<Int2> {
 struct World;
 struct Region;
 
-struct Chunk {
+/// Shared between a background job and the thread that submitted it, which can call it off
+struct JobTicket {
+    std::atomic<bool> cancelled = false;
+};
+
+/// Background jobs keep the chunks they read alive, the data of a loaded chunk doesn't change while they run
+struct Chunk : std::enable_shared_from_this<Chunk> {
     Region& region;
     int cx, cz;
-    McChunk* enkl_chunk = nullptr;
     ChunkData data = {};
-    std::unique_ptr<ChunkMesh> mesh;
+    /// One per section, left empty for sections without a single visible face
+    std::unique_ptr<ChunkMesh> meshes[CUNK_CHUNK_SECTIONS_COUNT];
+    /// Whether meshes were built at all: from then on, data.dirty_sections says which ones need rebuilding
+    bool meshed = false;
+    /// Set while a job meshes the chunk
+    std::shared_ptr<JobTicket> meshing;
 
     Chunk(Region&, int x, int z);
     Chunk(const Chunk&) = delete;
@@ -48,7 +59,9 @@ struct Region {
     McRegion* enkl_region = nullptr;
     bool loaded = false;
     bool unloaded = false;
-    std::unordered_map<Int2, std::unique_ptr<Chunk>> chunks;
+    std::unordered_map<Int2, std::shared_ptr<Chunk>> chunks;
+    /// Chunks of the region being loaded in the background, it stays around until they're done
+    unsigned pending_loads = 0;
 
     Region(World&, int rx, int rz);
     Region(const Region&) = delete;
@@ -56,25 +69,64 @@ struct Region {
 
     Chunk* get_chunk(unsigned rcx, unsigned rcz);
 protected:
-    Chunk* load_chunk(int cx, int cz);
     void unload_chunk(Chunk*);
     friend World;
 };
 
+/// Sections meshed in the background, for the render thread to upload
+struct MeshedChunk {
+    std::shared_ptr<Chunk> chunk;
+    std::shared_ptr<JobTicket> ticket;
+    /// Bit s is set for every section in geometry
+    uint32_t sections = 0;
+    ChunkMesh::Geometry geometry[CUNK_CHUNK_SECTIONS_COUNT];
+    /// The chunks around it, which the job read and which are dropped along with the result
+    std::shared_ptr<Chunk> neighbours[3][3];
+};
+
 struct World {
     Enkl_Allocator allocator;
     McWorld* enkl_world;
+    ThreadPool pool;
     std::unordered_map<Int2, std::unique_ptr<Region>> regions;
 
     explicit World(const char*);
     World(const World&) = delete;
     ~World();
 
-    Chunk* load_chunk(int x, int y);
     void unload_chunk(Chunk*);
     Chunk* get_loaded_chunk(int x, int z);
     std::vector<Chunk*> loaded_chunks();
+    /// Whether the chunk is stored in the world at all, only reads region headers
+    bool chunk_exists(int x, int z);
+
+    /// Starts loading the chunk in the background, unless it's loaded or on its way already. Jobs with a lower priority run first.
+    void request_chunk(int x, int z, float priority);
+    /// Calls off the loads of the chunks keep says no to. They can be requested again once collect_loaded_chunks has seen them through.
+    void cancel_requests(const std::function<bool(int x, int z)>& keep);
+    /// Adds the chunks loaded in the background since the last call
+    void collect_loaded_chunks();
+
+    /// Meshes some sections of a loaded chunk in the background, along with the chunks around it
+    void request_mesh(Chunk*, uint32_t sections, bool greedy, float priority);
+    /// Meshes finished since the last call, including the cancelled ones
+    void collect_meshes(const std::function<void(MeshedChunk&)>& f);
 private:
+    /// Headers of the regions chunk_exists was asked about. Dropped when their region is unloaded, the ones of regions never loaded (missing or empty) once there are too many.
+    std::unordered_map<Int2, McRegionIndex> region_indices;
+    static constexpr size_t max_region_indices = 64;
+
+    struct LoadedChunk {
+        std::shared_ptr<JobTicket> ticket;
+        Region* region;
+        int cx, cz;
+        std::shared_ptr<Chunk> chunk;
+    };
+    std::unordered_map<Int2, std::shared_ptr<JobTicket>> loading;
+    ResultQueue<LoadedChunk> loaded_queue;
+    ResultQueue<std::shared_ptr<MeshedChunk>> meshed_queue;
+
+    const McRegionIndex& get_region_index(int rx, int rz);
     Region* get_loaded_region(int rx, int rz);
     Region* load_region(int rx, int rz);
     void unload_region(Region*);